@@ -1,12 +1,27 @@
 #include <vector>
-#include <zlib.h>
+#include <map>
+#include <algorithm>
 #include <netinet/tcp.h>
 #include <poll.h>
 #include "utils.h"
 #include "events.h"
-
-uint64_t TIMEOUT_NS = 20000000;
-size_t const MAX_FROM_GUI_SIZE = 15;
+#include "ring_buffer.h"
+#include "compression.h"
+#include "shm_channel.h"
+#include "gui_protocol.h"
+#include "movement.h"
+
+/* Heartbeat is frequent while events stream in and slows down to keep-alive when idle */
+uint64_t const FAST_HEARTBEAT_NS = 20000000;
+uint64_t const IDLE_HEARTBEAT_NS = (INACTIVITY_TOLERANCE - 500) * 1000000;
+uint64_t const IDLE_AFTER_MS = 1000;
+size_t const GUI_INPUT_BUFFER_SIZE = 4096;
+size_t const GUI_BUFFER_SIZE = 65536;
+// longest line is NEW_GAME with all names from a single datagram
+size_t const MAX_GUI_LINE_SIZE = 32 + MAX_FROM_SERVER_DATAGRAM_SIZE;
+size_t const MAX_PIXEL_LINE_SIZE = 29 + MAX_PLAYER_NAME_LENGTH;
+// NEW_GAME has to fit in a single datagram even if it came compressed
+size_t const MAX_NEW_GAME_DATA_SIZE = MAX_FROM_SERVER_DATAGRAM_SIZE - 17;
 
 bool finish = false, clock_interrupt = false;
 timer_t registered_clock;
@@ -19,13 +34,47 @@ uint64_t session_id;
 std::string player_name;
 uint32_t maxx, maxy;
 std::vector<std::string> players;
+std::vector<uint32_t> last_x, last_y; //last pixel of every player, batched pixels are relative to it
+std::vector<uint8_t> has_pixel;
 
 int64_t game_id = -1;
 bool active_round = false;
 
-/* Game state messages to gui */
-std::vector<char> gui_messages;
-size_t head;
+/* Verified events received ahead of next_expected_event_no, keyed by event number */
+size_t const MAX_REORDERED_EVENTS = 1024;
+std::map<uint32_t, std::string> reordered;
+
+/* Protocol extensions, client probes for them and falls back to legacy messages */
+uint8_t client_caps = Event::CAP_SACK | Event::CAP_BATCH | Event::CAP_DEFLATE;
+size_t const MAX_PROBES = 25;
+bool negotiating = true;
+size_t probes_sent = 0;
+uint8_t server_caps = 0;
+Inflater inflater;
+
+/* Game state messages to gui, text lines or binary records */
+RingBuffer gui_messages(GUI_BUFFER_SIZE);
+bool binary_gui = false;
+
+/* Own snake drawn ahead of the server by the round trip, so that turns show at once. Predicted
+ * pixels stay until events confirm them or events leading to a later state prove them wrong. */
+size_t const MAX_PREDICTED_STEPS = 64;
+using PixelPosition = std::pair<uint32_t, uint32_t>;
+bool predict = false;
+bool has_state = false;
+Event::SnakeState state; //the latest one server sent
+uint32_t state_game_id;
+uint64_t state_time; //microseconds when the state arrived
+int64_t own_game_id = -1; //round in which own_snake plays
+uint8_t own_snake;
+std::vector<PixelPosition> predicted; //shown and not confirmed yet
+
+/* Server datagrams are read in batches, gui gets all text decoded from them in one write */
+size_t const MAX_RECV_BATCH = 64;
+char received[MAX_RECV_BATCH][MAX_FROM_SERVER_DATAGRAM_SIZE];
+// lines of a datagram full of PIXEL events (22 bytes each), compressed ones which don't fit
+// are requested again
+size_t const MAX_DATAGRAM_GUI_SIZE = MAX_FROM_SERVER_DATAGRAM_SIZE / 22 * MAX_PIXEL_LINE_SIZE;
 
 void catch_int (int sig)
 {
@@ -39,36 +88,43 @@ void timer_handler(int sig, siginfo_t *si, void *uc)
     }
 }
 
-void set_turn_direction_accordingly(std::string &m)
+bool is_command(char const *m, size_t len, char const *command)
+{
+    return len == strlen(command) && memcmp(m, command, len) == 0;
+}
+
+void set_turn_direction_accordingly(char const *m, size_t len)
 {
-    if (m == "LEFT_KEY_DOWN") {
+    if (is_command(m, len, "LEFT_KEY_DOWN")) {
         turn_direction = -1;
     }
-    else if (m == "RIGHT_KEY_DOWN") {
+    else if (is_command(m, len, "RIGHT_KEY_DOWN")) {
         turn_direction = 1;
     }
-    else if (m == "LEFT_KEY_UP" || m == "RIGHT_KEY_UP") {
+    else if (is_command(m, len, "LEFT_KEY_UP") || is_command(m, len, "RIGHT_KEY_UP")) {
         turn_direction = 0;
     }
 }
 
-void process_gui_response(std::string &gbuf, size_t &ggot, size_t &rec)
+// applies every complete line among ggot bytes of gbuf and moves the incomplete rest
+// to the beginning of the buffer, returns true if turn direction has changed
+bool process_gui_response(std::vector<char> &gbuf, size_t &ggot)
 {
-    size_t i;
-    for (i = 0; i < rec; ++i) {
-        if (gbuf[ggot + i] == '\n') {
-            break;
+    int8_t old_turn_direction = turn_direction;
+    size_t begin = 0;
+    for (size_t i = 0; i < ggot; ++i) {
+        if (gbuf[i] == '\n') {
+            set_turn_direction_accordingly(&gbuf[begin], i - begin);
+            begin = i + 1;
         }
     }
-    if (i < rec) {
-        std::string message = gbuf.substr(0, ggot + i);
-        set_turn_direction_accordingly(message);
-        // trim new line and rewrite rest to beginning of the buffer
-        for (size_t j = 0; j < rec - i - 1; j++) {
-            gbuf[j] = gbuf[ggot + i + 1 + j];
-        }
-        ggot = rec - i - 1;
+    if (begin == 0 && ggot == gbuf.size()) {
+        // line longer than whole buffer can't be a valid command
+        begin = ggot;
     }
+    memmove(&gbuf[0], &gbuf[begin], ggot - begin);
+    ggot -= begin;
+    return old_turn_direction != turn_direction;
 }
 
 std::string to_server_message()
@@ -78,37 +134,96 @@ std::string to_server_message()
     e.turn_direction = turn_direction;
     e.next_expected_event_no = next_expected_event_no;
     e.player_name = player_name;
+    if (negotiating && ++probes_sent > MAX_PROBES) {
+        // legacy server silently drops extended messages
+        negotiating = false;
+    }
+    e.extended = negotiating || server_caps;
+    e.caps = negotiating? (client_caps | Event::CAP_PROBE) : server_caps;
+    if (server_caps & Event::CAP_SACK) {
+        for (auto &r : reordered) {
+            if (!e.received.empty() && e.received.back().second == r.first) {
+                ++e.received.back().second;
+            }
+            else if (e.received.size() < Event::MAX_SACK_RANGES) {
+                e.received.push_back(Event::EventRange{r.first, r.first + 1});
+            }
+            else {
+                break;
+            }
+        }
+    }
     return e.serialize();
 }
 
-// returns next message number or 0 on error
-uint32_t verify_message(std::string &datagram, size_t pos)
+// replaces compressed events with inflated ones, false if datagram is corrupted
+bool inflate_datagram(std::string &datagram)
 {
-    if (pos + 4 >= datagram.size()) {
-        return 0;
+    size_t begin = 4 + Event::COMPRESSED_HEADER_SIZE;
+    if (datagram.size() < begin || Event::parse<uint32_t>(&datagram[4]) != Event::COMPRESSED_MARK) {
+        return true;
     }
-    uint32_t len = Event::parse<uint32_t>(&datagram[pos]);
-    if (pos + len + 8 > datagram.size()) {
-        return 0;
+    size_t length = Event::parse<uint16_t>(&datagram[8]);
+    if (begin + length > datagram.size()) {
+        return false;
+    }
+    std::string inflated = datagram.substr(0, 4);
+    if (!inflater.decompress(&datagram[begin], length, Event::MAX_INFLATED_SIZE, inflated)) {
+        return false;
     }
-    uint32_t crc = crc32(0, reinterpret_cast<unsigned char *>(&datagram[pos]), len + 4);
-    uint32_t rcrc = Event::parse<uint32_t>(&datagram[pos + len + 4]);
-    if (crc != rcrc) {
-        return 0;
+    inflated.append(datagram, begin + length, std::string::npos);
+    datagram.swap(inflated);
+    return true;
+}
+
+// position of capabilities trailer following events in datagram, npos if there is none
+size_t find_caps_trailer(std::string const &datagram)
+{
+    size_t pos = 4;
+    while (pos + 4 <= datagram.size()) {
+        uint32_t len = Event::parse<uint32_t>(&datagram[pos]);
+        if (len == Event::CAPS_TRAILER_MARK) {
+            return (pos + Event::CAPS_TRAILER_SIZE <= datagram.size())? pos : std::string::npos;
+        }
+        pos += static_cast<size_t>(len) + 8;
     }
-    return len;
+    return std::string::npos;
 }
 
-void push_event_to_gui(std::stringstream &ss)
+// copies as much of str as fits before limit
+char *append(char *out, char const *limit, char const *str, size_t len)
 {
-    ss << std::endl;
-    auto s = ss.str();
-    gui_messages.insert(gui_messages.end(), s.begin(), s.end());
+    len = std::min<size_t>(len, limit - out);
+    memcpy(out, str, len);
+    return out + len;
+}
+
+char *append(char *out, char const *limit, std::string const &str)
+{
+    return append(out, limit, str.data(), str.size());
+}
+
+char *append_uint32(char *out, char const *limit, uint32_t n)
+{
+    uint32_t hn = bswap(n);
+    return append(out, limit, reinterpret_cast<char const *>(&hn), sizeof(hn));
+}
+
+// terminates the line and queues it for gui, false if gui buffer is full
+bool push_event_to_gui(char *line, char *end)
+{
+    *end++ = '\n';
+    return gui_messages.push(line, end - line);
+}
+
+bool push_record_to_gui(char const *record, char const *end)
+{
+    return gui_messages.push(record, end - record);
 }
 
 bool new_game(std::string event_data)
 {
-    if (event_data.length() < 8) {
+    if (event_data.length() < 8 || event_data.length() > MAX_NEW_GAME_DATA_SIZE) {
         return false;
     }
     maxx = Event::parse<uint32_t>(&event_data[0]);
@@ -116,7 +231,7 @@ bool new_game(std::string event_data)
     players.clear();
     for (size_t it = 8, b_it=8; it < event_data.size(); it++) {
         if (event_data[it] == '\0') {
-            if (it <= b_it) {
+            if (it <= b_it || it - b_it > MAX_PLAYER_NAME_LENGTH) {
                 return false;
             }
             players.push_back(std::string(event_data.begin() + b_it, event_data.begin() + it));
@@ -129,14 +244,92 @@ bool new_game(std::string event_data)
     if (players.size() < REQUIRED_PLAYERS) {
         return false;
     }
-    std::stringstream ss;
-    ss << "NEW_GAME " << maxx << " " << maxy << " ";
-    for (auto &p : players) {
-        ss << p << " ";
+    char line[MAX_GUI_LINE_SIZE];
+    char *end = line, *limit = line + sizeof(line) - 1; // room for the newline
+    bool pushed;
+    if (binary_gui) {
+        *end++ = GuiProtocol::NEW_GAME;
+        end = append_uint32(end, limit, maxx);
+        end = append_uint32(end, limit, maxy);
+        *end++ = static_cast<char>(players.size());
+        for (auto &p : players) {
+            char length = static_cast<char>(p.size());
+            end = append(end, limit, &length, 1);
+            end = append(end, limit, p);
+        }
+        pushed = push_record_to_gui(line, end);
+    }
+    else {
+        end = append(line, limit, "NEW_GAME ", 9);
+        end = format_uint32(end, maxx);
+        *end++ = ' ';
+        end = format_uint32(end, maxy);
+        *end++ = ' ';
+        for (auto &p : players) {
+            end = append(end, limit, p);
+            end = append(end, limit, " ", 1);
+        }
+        pushed = push_event_to_gui(line, end);
+    }
+    if (!pushed) {
+        return false;
+    }
+    last_x.assign(players.size(), 0);
+    last_y.assign(players.size(), 0);
+    has_pixel.assign(players.size(), false);
+    // gui starts with an empty board
+    predicted.clear();
+    return true;
+}
+
+// record is PIXEL or one of predicted pixel records
+bool push_pixel(uint32_t x, uint32_t y, uint8_t player, uint8_t record)
+{
+    char line[MAX_GUI_LINE_SIZE];
+    char *end = line, *limit = line + sizeof(line) - 1; // room for the newline
+    if (binary_gui) {
+        *end++ = record;
+        *end++ = static_cast<char>(player);
+        end = append_uint32(end, limit, x);
+        end = append_uint32(end, limit, y);
+        return push_record_to_gui(line, end);
+    }
+    if (record == GuiProtocol::PREDICTED_PIXEL) {
+        end = append(end, limit, "PREDICTED_", 10);
+    }
+    else if (record == GuiProtocol::RETRACTED_PIXEL) {
+        end = append(end, limit, "RETRACTED_", 10);
+    }
+    end = append(end, limit, "PIXEL ", 6);
+    end = format_uint32(end, x);
+    *end++ = ' ';
+    end = format_uint32(end, y);
+    *end++ = ' ';
+    end = append(end, limit, players[player]);
+    return push_event_to_gui(line, end);
+}
+
+bool is_own_snake(uint8_t player)
+{
+    return own_game_id == game_id && own_snake == player;
+}
+
+void confirm_prediction(uint32_t x, uint32_t y, uint8_t player)
+{
+    if (!predicted.empty() && is_own_snake(player)) {
+        predicted.erase(std::remove(predicted.begin(), predicted.end(), PixelPosition{x, y}), predicted.end());
+    }
+}
+
+// returns false if gui buffer had no room for all retractions
+bool retract_predictions()
+{
+    while (!predicted.empty()) {
+        if (!push_pixel(predicted.back().first, predicted.back().second, own_snake, GuiProtocol::RETRACTED_PIXEL)) {
+            return false;
+        }
+        predicted.pop_back();
     }
-    gui_messages.clear();
-    head = 0;
-    push_event_to_gui(ss);
     return true;
 }
 
@@ -154,9 +347,53 @@ bool pixel(std::string event_data)
     if (x >= maxx || y >= maxy) {
         return false;
     }
-    std::stringstream ss;
-    ss << "PIXEL " << x << " " << y << " " << players[player];
-    push_event_to_gui(ss);
+    if (!push_pixel(x, y, player, GuiProtocol::PIXEL)) {
+        return false;
+    }
+    confirm_prediction(x, y, player);
+    last_x[player] = x;
+    last_y[player] = y;
+    has_pixel[player] = true;
+    return true;
+}
+
+// batch is either applied as a whole or not at all, room for its lines is checked up front as
+// names are at most MAX_PLAYER_NAME_LENGTH long
+bool pixel_batch(std::string event_data)
+{
+    if (event_data.length() % 2 != 0 ||
+            gui_messages.space() < event_data.length() / 2 * MAX_PIXEL_LINE_SIZE) {
+        return false;
+    }
+    std::vector<uint32_t> xs = last_x, ys = last_y;
+    for (size_t it = 0; it < event_data.length(); it += 2) {
+        uint8_t player = Event::parse<uint8_t>(&event_data[it]);
+        int32_t dx, dy;
+        if (player >= players.size() || !has_pixel[player] ||
+                !Event::parse_step(event_data[it + 1], dx, dy)) {
+            return false;
+        }
+        xs[player] += dx;
+        ys[player] += dy;
+        if (xs[player] >= maxx || ys[player] >= maxy) {
+            return false;
+        }
+    }
+    xs = last_x;
+    ys = last_y;
+    for (size_t it = 0; it < event_data.length(); it += 2) {
+        uint8_t player = Event::parse<uint8_t>(&event_data[it]);
+        int32_t dx, dy;
+        Event::parse_step(event_data[it + 1], dx, dy);
+        xs[player] += dx;
+        ys[player] += dy;
+        if (!push_pixel(xs[player], ys[player], player, GuiProtocol::PIXEL)) {
+            return false;
+        }
+        confirm_prediction(xs[player], ys[player], player);
+    }
+    last_x.swap(xs);
+    last_y.swap(ys);
     return true;
 }
 
@@ -169,61 +406,268 @@ bool player_eliminated(std::string event_data)
     if (player >= players.size()) {
         return false;
     }
-    std::stringstream ss;
-    ss << "PLAYER_ELIMINATED " << players[player];
-    push_event_to_gui(ss);
+    // nothing predicted for eliminated snake is going to come
+    if (is_own_snake(player) && !retract_predictions()) {
+        return false;
+    }
+    char line[MAX_GUI_LINE_SIZE];
+    char *end = line, *limit = line + sizeof(line) - 1; // room for the newline
+    if (binary_gui) {
+        *end++ = GuiProtocol::PLAYER_ELIMINATED;
+        *end++ = static_cast<char>(player);
+        return push_record_to_gui(line, end);
+    }
+    end = append(line, limit, "PLAYER_ELIMINATED ", 18);
+    end = append(end, limit, players[player]);
+    return push_event_to_gui(line, end);
+}
+
+// applies event number next_expected_event_no, returns false if it can't be applied
+bool apply_event(uint32_t r_game_id, char mtype, std::string const &event_data)
+{
+    if (mtype == 0 && next_expected_event_no == 0 && !active_round) {
+        if (!new_game(event_data)) {
+            return false;
+        }
+        game_id = r_game_id;
+        active_round = true;
+    }
+    else if (mtype == 1 && active_round) {
+        if (!pixel(event_data)) {
+            return false;
+        }
+    }
+    else if (mtype == 4 && active_round) {
+        if (!pixel_batch(event_data)) {
+            return false;
+        }
+    }
+    else if (mtype == 2 && active_round) {
+        if (!player_eliminated(event_data)) {
+            return false;
+        }
+    }
+    else if (mtype == 3 && active_round) {
+        if (!retract_predictions()) {
+            return false;
+        }
+        next_expected_event_no = 0;
+        active_round = false;
+        reordered.clear();
+        return true;
+    }
+    else {
+        return false;
+    }
+    ++next_expected_event_no;
     return true;
 }
 
+// releases buffered events which follow the contiguous prefix
+void apply_reordered(uint32_t r_game_id)
+{
+    while (!reordered.empty() && active_round) {
+        auto first = reordered.begin();
+        if (first->first < next_expected_event_no) {
+            reordered.erase(first);
+            continue;
+        }
+        if (first->first != next_expected_event_no ||
+                !apply_event(r_game_id, first->second[0], first->second.substr(1))) {
+            return;
+        }
+        reordered.erase(first);
+    }
+}
+
+// keeps the latest state of own snake, datagrams sent earlier may come later
+void got_snake_state(uint32_t r_game_id, Event::SnakeState const &s)
+{
+    if (has_state && state_game_id == r_game_id && (s.events < state.events ||
+            (s.events == state.events && s.x == state.x && s.y == state.y && s.direction == state.direction))) {
+        return;
+    }
+    has_state = true;
+    state = s;
+    state_game_id = r_game_id;
+    state_time = monotonic_microseconds();
+    if (s.snake != Event::SnakeState::NO_SNAKE) {
+        own_game_id = r_game_id;
+        own_snake = s.snake;
+    }
+}
+
+// pixels own snake moves to from the state while the current turn direction reaches server
+std::vector<PixelPosition> predicted_path()
+{
+    Physics physics = static_cast<Physics>(state.physics);
+    SnakeArrays s;
+    s.push_back(0, 0, state.direction, turn_direction);
+    if (physics == Physics::FIXED) {
+        s.fx[0] = static_cast<int64_t>(state.x);
+        s.fy[0] = static_cast<int64_t>(state.y);
+    }
+    else {
+        memcpy(&s.x[0], &state.x, sizeof(state.x));
+        memcpy(&s.y[0], &state.y, sizeof(state.y));
+    }
+    uint64_t ahead = state.rtt + (monotonic_microseconds() - state_time);
+    uint64_t steps = std::min<uint64_t>(MAX_PREDICTED_STEPS, ahead * state.game_speed / 1000000);
+    std::vector<PixelPosition> path;
+    uint32_t x, y, nx, ny;
+    snake_pixel(s, 0, physics, x, y);
+    for (uint64_t i = 0; i < steps; ++i) {
+        advance_snakes(s, state.turning_speed, physics);
+        snake_pixel(s, 0, physics, nx, ny);
+        if (nx >= maxx || ny >= maxy) {
+            break;
+        }
+        if (nx != x || ny != y) {
+            path.push_back(PixelPosition{nx, ny});
+            x = nx;
+            y = ny;
+        }
+    }
+    return path;
+}
+
+// redraws predicted part of own snake, predictions never take room events need
+void update_prediction()
+{
+    if (!predict || !active_round || gui_messages.space() < GUI_BUFFER_SIZE / 2) {
+        return;
+    }
+    bool playing = has_state && state_game_id == game_id && state.snake != Event::SnakeState::NO_SNAKE &&
+            state.snake < players.size();
+    std::vector<PixelPosition> path;
+    if (playing) {
+        path = predicted_path();
+    }
+    // once events leading to the state are applied, predictions they didn't confirm are wrong
+    if (playing && next_expected_event_no >= state.events) {
+        for (size_t i = predicted.size(); i-- > 0;) {
+            if (std::find(path.begin(), path.end(), predicted[i]) == path.end()) {
+                push_pixel(predicted[i].first, predicted[i].second, own_snake, GuiProtocol::RETRACTED_PIXEL);
+                predicted.erase(predicted.begin() + i);
+            }
+        }
+    }
+    for (auto &p : path) {
+        if (std::find(predicted.begin(), predicted.end(), p) == predicted.end()) {
+            push_pixel(p.first, p.second, state.snake, GuiProtocol::PREDICTED_PIXEL);
+            predicted.push_back(p);
+        }
+    }
+}
+
 void got_message_from_server(std::string &datagram)
 {
-    if (datagram.length() < 4) {
+    if (datagram.length() < 4 || !inflate_datagram(datagram)) {
         return;
     }
+    size_t trailer = find_caps_trailer(datagram);
+    Event::SnakeState s;
+    bool got_state = false;
+    if (trailer != std::string::npos) {
+        server_caps = datagram[trailer + 4] & client_caps;
+        negotiating = false;
+        size_t state_at = trailer + Event::CAPS_TRAILER_SIZE;
+        got_state = (server_caps & Event::CAP_PREDICT) &&
+                s.parse(&datagram[state_at], datagram.size() - state_at);
+        datagram.resize(trailer);
+    }
+    else if (negotiating) {
+        // server which knows extensions acknowledges them in every datagram
+        negotiating = false;
+        server_caps = 0;
+    }
     uint32_t r_game_id = Event::parse<uint32_t>(&datagram[0]);
     if ((active_round && game_id != r_game_id) || (!active_round && game_id == r_game_id)) {
         return;
     }
+    if (got_state) {
+        got_snake_state(r_game_id, s);
+    }
     size_t it = 4, len = 0;
-    while ((len = verify_message(datagram, it))) {
+    // event that can't be applied (also when gui buffer is full) stays expected and gets resent
+    while ((len = Event::verify_message(datagram, it)) > 0) {
         uint32_t event_no = Event::parse<uint32_t>(&datagram[it + 4]);
         if (next_expected_event_no == event_no) {
-            char mtype = datagram[it + 8];
-            if (mtype == 0) {
-                if (event_no == 0 && !active_round) {
-                    if (!new_game(std::string(&datagram[it + 9], len - 5))) {
-                        break;
-                    }
-                    next_expected_event_no = event_no + 1;
-                    game_id = r_game_id;
-                    active_round = true;
-                }
-            }
-            else if (mtype == 1 && active_round) {
-                if (!pixel(std::string(&datagram[it + 9], len - 5))) {
-                    break;
-                }
-                next_expected_event_no = event_no + 1;
-            }
-            else if (mtype == 2 && active_round) {
-                if (!player_eliminated(std::string(&datagram[it + 9], len - 5))) {
-                    break;
-                }
-                next_expected_event_no = event_no + 1;
-            }
-            else if (mtype == 3 && active_round) {
-                next_expected_event_no = 0;
-                active_round = false;
+            if (!apply_event(r_game_id, datagram[it + 8], std::string(&datagram[it + 9], len - 5))) {
                 break;
             }
-            else {
+            if (!active_round) {
+                // the rest belongs to the round that has just finished
                 break;
             }
+            apply_reordered(r_game_id);
+        }
+        else if (active_round && event_no > next_expected_event_no &&
+                event_no - next_expected_event_no <= MAX_REORDERED_EVENTS &&
+                reordered.size() < MAX_REORDERED_EVENTS) {
+            // keep type and data of the event until the gap before it is filled
+            reordered.emplace(event_no, std::string(&datagram[it + 8], len - 4));
         }
         it += len + 8;
     }
 }
 
+// reads datagrams waiting on the socket while gui buffer has room for what they bring,
+// true if any of them moved the client forward
+bool drain_server_socket(int fd)
+{
+    iovec iovs[MAX_RECV_BATCH];
+    mmsghdr msgs[MAX_RECV_BATCH] = {};
+    for (size_t i = 0; i < MAX_RECV_BATCH; ++i) {
+        iovs[i].iov_base = received[i];
+        iovs[i].iov_len = sizeof(received[i]);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    bool progress = false;
+    int got;
+    size_t batch;
+    // datagrams gui has no room for are left in the socket
+    while ((batch = std::min(MAX_RECV_BATCH, gui_messages.space() / MAX_DATAGRAM_GUI_SIZE)) > 0) {
+        got = recvmmsg(fd, msgs, batch, MSG_DONTWAIT, nullptr);
+        for (int i = 0; i < got; ++i) {
+            // simply ignore incorrect messages
+            if (msgs[i].msg_len == 0 || (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+                std::cerr << "Droping incorrect message" << std::endl;
+                continue;
+            }
+            std::string sbuf(received[i], msgs[i].msg_len);
+            uint32_t expected_before = next_expected_event_no;
+            size_t reordered_before = reordered.size();
+            got_message_from_server(sbuf);
+            // resends of events client already has (e.g. of finished round) don't count
+            if (expected_before != next_expected_event_no || reordered_before != reordered.size()) {
+                progress = true;
+            }
+        }
+        if (got < static_cast<int>(batch)) {
+            break;
+        }
+    }
+    return progress;
+}
+
+// moves pending gui lines to shared memory ring as far as there is room
+void flush_to_channel(ShmChannel &channel)
+{
+    iovec iov[2];
+    int cnt = gui_messages.pending(iov);
+    size_t moved = 0;
+    for (int i = 0; i < cnt; ++i) {
+        size_t n = channel.write(static_cast<char *>(iov[i].iov_base), iov[i].iov_len);
+        moved += n;
+        if (n < iov[i].iov_len) {
+            break;
+        }
+    }
+    gui_messages.consume(moved);
+}
+
 int main(int argc, char *argv[])
 {
 
@@ -236,22 +680,44 @@ int main(int argc, char *argv[])
     }
 
     /* Parsing arguments */
-    std::string sa, sp, ga, gp;
+    std::string sa, sp, ga, gp, shm_path;
+
+    bool usage = false;
+    int opt;
+    // options end at the first argument which isn't one, name starting with '-' follows "--"
+    while ((opt = getopt(argc, argv, "+bP")) != -1) {
+        if (opt == 'b') {
+            binary_gui = true;
+        }
+        else if (opt == 'P') {
+            predict = true;
+            client_caps |= Event::CAP_PREDICT;
+        }
+        else {
+            usage = true;
+        }
+    }
+    int args = argc - optind;
 
-    if (argc < 3 || argc > 4) {
+    if (usage || args < 2 || args > 3) {
         std::cerr << "Usage " << argv[0]
-                  << "player_name game_server_host[:port] [ui_server_host[:port]]" << std::endl;
+                  << " [-b] [-P] [--] player_name game_server_host[:port] [ui_server_host[:port] | shm:ui_socket_path]"
+                  << std::endl;
         return 1;
     }
 
-    player_name = argv[1];
-    sa = argv[2];
+    player_name = argv[optind];
+    sa = argv[optind + 1];
 
-    if (argc == 4) {
-        ga = argv[3];
+    if (args == 3) {
+        ga = argv[optind + 2];
+    }
+    if (ga.compare(0, 4, "shm:") == 0) {
+        shm_path = ga.substr(4);
+        ga.clear();
     }
 
-    if (player_name.length() > 64) {
+    if (player_name.length() > MAX_PLAYER_NAME_LENGTH) {
         std::cerr << "Player name too long" << std::endl;
         return 1;
     }
@@ -341,9 +807,14 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    /* GUI socket */
+    /* GUI socket, unless GUI on the same host is reached through shared memory */
     Socket gsock;
-    {
+    ShmChannel gui_channel;
+    if (shm_path.length() && !gui_channel.connect(shm_path)) {
+        std::cerr << last_err("Shared memory gui: ") << std::endl;
+        return 1;
+    }
+    if (shm_path.empty()) {
         struct addrinfo hints = {};
         hints.ai_family = AF_UNSPEC;
         hints.ai_socktype = SOCK_STREAM;
@@ -376,11 +847,11 @@ int main(int argc, char *argv[])
         }
     }
 
-    if (fcntl(gsock.fd, F_SETFL, O_NONBLOCK) < 0) {
+    if (gsock.fd != -1 && fcntl(gsock.fd, F_SETFL, O_NONBLOCK) < 0) {
         std::cerr << last_err("Fcntl gui: ") << std::endl;
         return 1;
     }
-    {
+    if (gsock.fd != -1) {
         int flag = 1;
         int result = setsockopt(gsock.fd, IPPROTO_TCP, TCP_NODELAY, (char *) &flag, sizeof(int));
         if (result < 0){
@@ -395,7 +866,7 @@ int main(int argc, char *argv[])
 
     /* Timer */
     try {
-        create_timer(registered_clock, TIMEOUT_NS, timer_handler);
+        create_timer(registered_clock, FAST_HEARTBEAT_NS, timer_handler);
     }
     catch (UtilsError const &e) {
         std::cerr << e.what();
@@ -404,49 +875,61 @@ int main(int argc, char *argv[])
 
     /* Communication kicks off */
     bool write_more_to_server = false, write_more_to_gui = false;
-    pollfd pollsocket[2];
+    pollfd pollsocket[3];
     pollfd &serverp = pollsocket[0];
     pollfd &guip = pollsocket[1];
+    pollfd &controlp = pollsocket[2]; // hangup of shared memory gui
     serverp.fd = ssock.fd;
-    guip.fd = gsock.fd;
+    guip.fd = shm_path.length()? gui_channel.wakeup_fd() : gsock.fd;
+    controlp.fd = shm_path.length()? gui_channel.control_fd() : -1;
+    controlp.events = POLLIN;
 
     /* Buffering */
-    std::string gbuf(MAX_FROM_GUI_SIZE, '\0');
+    std::vector<char> gbuf(GUI_INPUT_BUFFER_SIZE);
     size_t ggot = 0;
-    size_t max_datagram_size = MAX_FROM_SERVER_DATAGRAM_SIZE + 1;
+    uint64_t heartbeat = FAST_HEARTBEAT_NS;
+    uint64_t last_progress = milliseconds_since_epoch();
 
     while(!finish) {
-        for (size_t i = 0; i < 2; i++) {
+        for (size_t i = 0; i < 3; i++) {
             pollsocket[i].revents = 0;
         }
-        serverp.events = (!write_more_to_server)? POLLIN : (POLLIN | POLLOUT);
+        // server socket isn't read until gui takes some lines
+        serverp.events = (gui_messages.space() >= MAX_DATAGRAM_GUI_SIZE? POLLIN : 0) |
+                         (write_more_to_server? POLLOUT : 0);
         guip.events = (!write_more_to_gui)? POLLIN : (POLLIN | POLLOUT);
-        int ret = poll(pollsocket, 2, -1);
+        int ret = poll(pollsocket, 3, -1);
         if (ret <= 0 && !clock_interrupt) {
             continue;
         }
         /* Read messages */
-        if (guip.revents & POLLIN) {
-            size_t rec;
-            if((rec = recv(gsock.fd, &gbuf[ggot], gbuf.size() - ggot, 0)) <= 0) {
+        bool input_changed = false;
+        if (controlp.revents & (POLLIN | POLLHUP)) {
+            std::cerr << "GUI disconnected" << std::endl;
+            return 1;
+        }
+        if ((guip.revents & POLLIN) && shm_path.length()) {
+            gui_channel.clear_wakeups();
+            ggot += gui_channel.read(&gbuf[ggot], gbuf.size() - ggot);
+            input_changed = process_gui_response(gbuf, ggot);
+        }
+        else if (guip.revents & POLLIN) {
+            ssize_t rec = recv(gsock.fd, &gbuf[ggot], gbuf.size() - ggot, 0);
+            if (rec == 0 || (rec < 0 && errno != EWOULDBLOCK && errno != EAGAIN)) {
                 std::cerr << "GUI disconnected" << std::endl;
                 return 1;
             }
-            process_gui_response(gbuf, ggot, rec);
-        }
-        if (serverp.revents & POLLIN) {
-            std::string sbuf(max_datagram_size, '\0');
-            size_t len = recv(ssock.fd, &sbuf[0], MAX_FROM_SERVER_DATAGRAM_SIZE, 0);
-            // simply ignore incorrect messages or errors
-            if (len > 0 && len <= MAX_FROM_SERVER_DATAGRAM_SIZE) {
-                sbuf.resize(len);
-                got_message_from_server(sbuf);
-            }
-            else {
-                std::cerr << "Droping incorrect message" << std::endl;
+            if (rec > 0) {
+                ggot += rec;
+                input_changed = process_gui_response(gbuf, ggot);
             }
         }
-        if (clock_interrupt || (write_more_to_server && (serverp.revents & POLLOUT))) {
+        if ((serverp.revents & POLLIN) && drain_server_socket(ssock.fd)) {
+            last_progress = milliseconds_since_epoch();
+        }
+        // changed turn direction is sent right away instead of waiting for the timer
+        if (clock_interrupt || input_changed ||
+                (write_more_to_server && (serverp.revents & POLLOUT))) {
             std::string ssbuf = to_server_message();
             clock_interrupt = false;
             write_more_to_server = false;
@@ -455,9 +938,27 @@ int main(int argc, char *argv[])
                     write_more_to_server = true;
                 }
             }
+            // next heartbeat is due one full period after the last message
+            if (input_changed) {
+                set_timer(registered_clock, heartbeat);
+            }
+        }
+        update_prediction();
+        {
+            bool idle = reordered.empty() &&
+                    milliseconds_since_epoch() - last_progress >= IDLE_AFTER_MS;
+            uint64_t wanted = idle? IDLE_HEARTBEAT_NS : FAST_HEARTBEAT_NS;
+            if (wanted != heartbeat) {
+                heartbeat = wanted;
+                set_timer(registered_clock, heartbeat);
+            }
+        }
+        if (shm_path.length()) {
+            // gui wakes client up when it makes room for the rest
+            flush_to_channel(gui_channel);
         }
-        if (head < gui_messages.size() || write_more_to_gui) {
-            size_t len = send(gsock.fd, &gui_messages[head], gui_messages.size() - head, 0);
+        else if (!gui_messages.empty() || write_more_to_gui) {
+            ssize_t len = gui_messages.write_to(gsock.fd);
             write_more_to_gui = false;
             if (len == 0) {
                 std::cerr << "GUI disconnected (write)" << std::endl;
@@ -473,8 +974,7 @@ int main(int argc, char *argv[])
                 }
             }
             else {
-                head += len;
-                write_more_to_gui = (head < gui_messages.size());
+                write_more_to_gui = !gui_messages.empty();
             }
         }
     }
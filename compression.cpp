@@ -0,0 +1,92 @@
+#include "compression.h"
+#include "events.h"
+
+namespace {
+
+    // Typical catch-up content: framed pixels and batches with consecutive numbers and
+    // small coordinates. Later bytes are cheaper to refer to, so batches go last.
+    std::string const &dictionary()
+    {
+        static std::string const dict = [] {
+            Event::History h;
+            for (uint32_t i = 0; i < 16; ++i) {
+                Event::Pixel p;
+                p.player_number = i % 4;
+                p.x = 100 + i;
+                p.y = 100 + i / 2;
+                h.append(p);
+            }
+            for (uint32_t i = 0; i < 8; ++i) {
+                Event::PixelBatch b;
+                for (char player = 0; player < 4; ++player) {
+                    b.add(player, 1, (player + i) % 3 - 1);
+                }
+                h.append(b);
+            }
+            return std::string(h.events.begin(), h.events.end());
+        }();
+        return dict;
+    }
+
+    Bytef *bytes(char const *str)
+    {
+        return reinterpret_cast<Bytef *>(const_cast<char *>(str));
+    }
+}
+
+Deflater::Deflater() : stream{}
+{
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw UtilsError("Could not initialize deflate");
+    }
+}
+
+Deflater::~Deflater()
+{
+    deflateEnd(&stream);
+}
+
+bool Deflater::compress(std::string const &input, size_t limit, std::string &output)
+{
+    auto &dict = dictionary();
+    deflateReset(&stream);
+    deflateSetDictionary(&stream, bytes(dict.data()), dict.size());
+    output.resize(limit);
+    stream.next_in = bytes(input.data());
+    stream.avail_in = input.size();
+    stream.next_out = bytes(&output[0]);
+    stream.avail_out = limit;
+    if (deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+        return false;
+    }
+    output.resize(limit - stream.avail_out);
+    return true;
+}
+
+Inflater::Inflater() : stream{}
+{
+    if (inflateInit2(&stream, -15) != Z_OK) {
+        throw UtilsError("Could not initialize inflate");
+    }
+}
+
+Inflater::~Inflater()
+{
+    inflateEnd(&stream);
+}
+
+bool Inflater::decompress(char const *input, size_t length, size_t limit, std::string &output)
+{
+    auto &dict = dictionary();
+    inflateReset(&stream);
+    inflateSetDictionary(&stream, bytes(dict.data()), dict.size());
+    size_t begin = output.size();
+    output.resize(begin + limit);
+    stream.next_in = bytes(input);
+    stream.avail_in = length;
+    stream.next_out = bytes(&output[begin]);
+    stream.avail_out = limit;
+    bool finished = inflate(&stream, Z_FINISH) == Z_STREAM_END;
+    output.resize(begin + limit - stream.avail_out);
+    return finished;
+}
@@ -0,0 +1,36 @@
+#ifndef II_COMPRESSION_H
+#define II_COMPRESSION_H
+
+#include <string>
+#include <zlib.h>
+
+/* Raw deflate with preset dictionary shared by server and client, streams are reused */
+
+class Deflater {
+    z_stream stream;
+
+public:
+    Deflater();
+    ~Deflater();
+    Deflater(Deflater const &) = delete;
+    Deflater &operator=(Deflater const &) = delete;
+
+    // false if compressed input doesn't fit in limit bytes
+    bool compress(std::string const &input, size_t limit, std::string &output);
+};
+
+class Inflater {
+    z_stream stream;
+
+public:
+    Inflater();
+    ~Inflater();
+    Inflater(Inflater const &) = delete;
+    Inflater &operator=(Inflater const &) = delete;
+
+    // appends inflated input to output, false if input is corrupted or inflates to more
+    // than limit bytes
+    bool decompress(char const *input, size_t length, size_t limit, std::string &output);
+};
+
+#endif //II_COMPRESSION_H
@@ -1,3 +1,4 @@
+#include <zlib.h>
 #include "events.h"
 
 void Event::serialize_args(std::stringstream &ss) {}
@@ -37,9 +38,125 @@ std::string Event::GameOver::serialize()
     return Event::serialize(type);
 }
 
+void Event::PixelBatch::add(char player_number, int32_t dx, int32_t dy)
+{
+    steps += player_number;
+    steps += static_cast<char>(((dx + 1) << 2) | (dy + 1));
+}
+
+std::string Event::PixelBatch::serialize()
+{
+    return Event::serialize(type, steps);
+}
+
+bool Event::parse_step(char step, int32_t &dx, int32_t &dy)
+{
+    dx = ((step >> 2) & 3) - 1;
+    dy = (step & 3) - 1;
+    return (step & ~0xF) == 0 && dx <= 1 && dy <= 1;
+}
+
+uint32_t Event::verify_message(std::string const &datagram, size_t pos)
+{
+    if (pos + 4 >= datagram.size()) {
+        return 0;
+    }
+    uint32_t len = Event::parse<uint32_t>(&datagram[pos]);
+    if (len < 5 || pos + len + 8 > datagram.size()) {
+        return 0;
+    }
+    uint32_t crc = crc32(0, reinterpret_cast<unsigned char const *>(&datagram[pos]), len + 4);
+    if (crc != Event::parse<uint32_t>(&datagram[pos + len + 4])) {
+        return 0;
+    }
+    return len;
+}
+
+Event::SnakeState::SnakeState()
+        : snake{NO_SNAKE}, physics{0}, direction{0}, turning_speed{0}, game_speed{0}, events{0}, rtt{0},
+          x{0}, y{0} {}
+
+std::string Event::SnakeState::serialize()
+{
+    return Event::serialize(snake, physics, direction, turning_speed, game_speed, events, rtt, x, y);
+}
+
+bool Event::SnakeState::parse(char const *data, size_t length)
+{
+    if (length < SNAKE_STATE_SIZE) {
+        return false;
+    }
+    snake = data[0];
+    physics = data[1];
+    direction = Event::parse<uint16_t>(&data[2]);
+    turning_speed = Event::parse<uint16_t>(&data[4]);
+    game_speed = Event::parse<uint16_t>(&data[6]);
+    events = Event::parse<uint32_t>(&data[8]);
+    rtt = Event::parse<uint32_t>(&data[12]);
+    x = Event::parse<uint64_t>(&data[16]);
+    y = Event::parse<uint64_t>(&data[24]);
+    return snake == NO_SNAKE || (physics < 2 && direction < 360 && turning_speed < 360 && game_speed > 0);
+}
+
+size_t Event::History::size() const
+{
+    return positions.size();
+}
+
+void Event::History::clear()
+{
+    events.clear();
+    positions.clear();
+}
+
+void Event::History::reserve(size_t events_no, size_t bytes)
+{
+    positions.reserve(events_no);
+    events.reserve(bytes);
+}
+
+void Event::History::append(SerializableEvent &e)
+{
+    std::string es = e.serialize();
+    uint32_t length = bswap(static_cast<uint32_t>(es.length() + 4));
+    uint32_t event_no = bswap(static_cast<uint32_t>(positions.size()));
+    // frame the event in place at the end of history
+    size_t begin = events.size();
+    events.resize(begin + es.length() + 12);
+    char *out = &events[begin];
+    memcpy(out, &length, 4);
+    memcpy(out + 4, &event_no, 4);
+    memcpy(out + 8, es.data(), es.length());
+    uint32_t crc = bswap(static_cast<uint32_t>(
+            crc32(0, reinterpret_cast<unsigned char *>(out), es.length() + 8)));
+    memcpy(out + 8 + es.length(), &crc, 4);
+    positions.push_back(events.size());
+}
+
+void Event::History::append_framed(char const *event, size_t length)
+{
+    events.insert(events.end(), event, event + length);
+    positions.push_back(events.size());
+}
+
+size_t Event::History::begin(size_t event_no) const
+{
+    return (event_no == 0)? 0 : positions[event_no - 1];
+}
+
+Event::ClientEvent::ClientEvent() : extended{false}, caps{0} {}
+
 std::string Event::ClientEvent::serialize()
 {
-    return Event::serialize(session_id, turn_direction, next_expected_event_no, player_name);
+    std::string s = Event::serialize(session_id, turn_direction, next_expected_event_no, player_name);
+    if (extended) {
+        char separator = '\0', count = std::min(received.size(), MAX_SACK_RANGES);
+        s += Event::serialize(separator, caps, count);
+        for (char i = 0; i < count; ++i) {
+            s += Event::serialize(received[i].first, received[i].second);
+        }
+    }
+    return s;
 }
 
 bool Event::ClientEvent::parse(std::string const &str)
@@ -53,11 +170,38 @@ bool Event::ClientEvent::parse(std::string const &str)
         return false;
     }
     next_expected_event_no = Event::parse<uint32_t>(&str[9]);
-    player_name = str.substr(13, str.length() - 13);
+    size_t name_end = str.find('\0', 13);
+    extended = name_end != std::string::npos;
+    player_name = str.substr(13, (extended? name_end : str.length()) - 13);
+    if (player_name.length() > MAX_PLAYER_NAME_LENGTH) {
+        return false;
+    }
     for (auto s : player_name) {
         if (s < 33 || s > 126) {
            return false;
         }
     }
+    caps = 0;
+    received.clear();
+    if (!extended) {
+        return true;
+    }
+    size_t it = name_end + 1;
+    if (it + 2 > str.length()) {
+        return false;
+    }
+    caps = str[it];
+    size_t count = static_cast<uint8_t>(str[it + 1]);
+    it += 2;
+    if (count > MAX_SACK_RANGES || it + 8 * count != str.length()) {
+        return false;
+    }
+    for (; it < str.length(); it += 8) {
+        EventRange range{Event::parse<uint32_t>(&str[it]), Event::parse<uint32_t>(&str[it + 4])};
+        if (range.first >= range.second) {
+            return false;
+        }
+        received.push_back(range);
+    }
     return true;
 }
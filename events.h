@@ -1,9 +1,30 @@
 #ifndef II_EVENTS_H
 #define II_EVENTS_H
+#include <vector>
 #include "utils.h"
 
 namespace Event {
 
+    /* Protocol extensions negotiated per client */
+    uint8_t const CAP_SACK = 1; // client reports ranges of events it already holds
+    uint8_t const CAP_BATCH = 2; // client is served history with pixels of a tick in one event
+    uint8_t const CAP_DEFLATE = 4; // client accepts compressed datagrams when far behind
+    uint8_t const CAP_PREDICT = 8; // client predicts own snake from its state following the trailer
+    uint8_t const CAP_PROBE = 0x80; // client asks server to acknowledge capabilities
+    size_t const MAX_SACK_RANGES = 4;
+    // Server acknowledges capabilities with trailer placed after events of every datagram sent to
+    // an extended client, its length field can't be mistaken for an event.
+    uint32_t const CAPS_TRAILER_MARK = 0xFFFFFFFF;
+    size_t const CAPS_TRAILER_SIZE = 5;
+    size_t const SNAKE_STATE_SIZE = 32;
+    // Compressed datagram has this mark right after game id, then 2 bytes of compressed length,
+    // raw deflate of events and possibly a trailer.
+    uint32_t const COMPRESSED_MARK = 0xFFFFFFFE;
+    size_t const COMPRESSED_HEADER_SIZE = 6;
+    size_t const MAX_INFLATED_SIZE = 8 * MAX_FROM_SERVER_DATAGRAM_SIZE;
+
+    using EventRange = std::pair<uint32_t, uint32_t>; // [first, second) event numbers
+
     template<typename IntegerType>
     std::string serialize(IntegerType n)
     {
@@ -71,12 +92,64 @@ namespace Event {
         std::string serialize();
     };
 
+    // Pixels snakes moved to within a tick, each as player number and a step from player's
+    // previous pixel. Step packs dx + 1 in bits 2-3 and dy + 1 in bits 0-1.
+    struct PixelBatch : public EventType<4>, public SerializableEvent {
+        std::string steps;
+
+        void add(char player_number, int32_t dx, int32_t dy);
+        std::string serialize();
+    };
+
+    // false if step isn't a move by at most one pixel in each direction
+    bool parse_step(char step, int32_t &dx, int32_t &dy);
+
+    // length of framed event at pos of datagram (without its number and crc32) or 0 if it's
+    // cut short, fails its checksum or hasn't even a type
+    uint32_t verify_message(std::string const &datagram, size_t pos);
+
+    /* Framed events of a round: length, event number, event data and crc32 of all these */
+    struct History {
+        std::vector<char> events;
+        std::vector<size_t> positions; // end of each event in events
+
+        size_t size() const;
+        void clear();
+        void reserve(size_t events_no, size_t bytes);
+        void append(SerializableEvent &e);
+        void append_framed(char const *event, size_t length); //event is already framed with next number
+        size_t begin(size_t event_no) const;
+    };
+
+    /* Own snake of a predicting client as it is after the last tick, follows caps byte of the
+     * trailer. Coordinates are bits of doubles or fixed point values depending on physics. */
+    struct SnakeState {
+        static uint8_t const NO_SNAKE = 0xFF; // client doesn't play in the current round
+
+        uint8_t snake, physics;
+        uint16_t direction, turning_speed, game_speed;
+        uint32_t events; // history size when state was taken, events before it lead to it
+        uint32_t rtt; // smoothed round trip to the client in microseconds
+        uint64_t x, y;
+
+        SnakeState();
+
+        std::string serialize();
+        bool parse(char const *data, size_t length);
+    };
+
     /* Client to server events */
     struct ClientEvent : public SerializableEvent {
         uint64_t session_id;
         int8_t turn_direction;
         uint32_t next_expected_event_no;
         std::string player_name;
+        /* Extension block: '\0' after name, caps, ranges count and ranges */
+        bool extended;
+        uint8_t caps;
+        std::vector<EventRange> received; // events held beyond next_expected_event_no
+
+        ClientEvent();
 
         std::string serialize();
         bool parse(std::string const &);
@@ -0,0 +1,22 @@
+#ifndef II_FIXED_POINT_H
+#define II_FIXED_POINT_H
+
+#include <cstdint>
+
+/* Q.16 fixed point arithmetic used by deterministic movement */
+namespace FixedPoint {
+
+    int32_t const FRACTION_BITS = 16;
+    int64_t const ONE = INT64_C(1) << FRACTION_BITS;
+
+    // unit vector components of whole degree heading in [0, 360), scaled by ONE
+    int32_t cos(int32_t degrees);
+    int32_t sin(int32_t degrees);
+
+    // middle of the pixel
+    int64_t from_pixel(uint32_t pixel);
+    // pixel containing the point, coordinate belongs to pixel floor(value / ONE)
+    uint32_t to_pixel(int64_t value);
+}
+
+#endif //II_FIXED_POINT_H
@@ -1,14 +1,14 @@
-#define _USE_MATH_DEFINES
 #include "game_state.h"
+#include "trace.h"
 
 
-Generator r(0);
-
-GameState::GameState(uint32_t seed, uint32_t gs, uint32_t ts, uint32_t mx, uint32_t my)
-        : inner_counter{0}, head_in_progress{false}, head_expected_no{0}, board{gs, ts, mx, my}
-{
-    r = Generator(seed);
-}
+GameState::GameState(uint32_t seed, uint32_t gs, uint32_t ts, uint32_t mx, uint32_t my,
+                     Physics physics, uint32_t flush_ms)
+        : inner_counter{0}, head_in_progress{false}, head_batched{false}, head_expected_no{0},
+          head_next_no{0}, head_segments{0}, drained{true}, all_deferred{false},
+          flush_ticks{std::max<uint32_t>(1, static_cast<uint64_t>(flush_ms) * gs / 1000)},
+          unflushed_ticks{0}, unflushed_events{false},
+          board{gs, ts, mx, my, physics}, random{seed} {}
 
 GameProgress Round::is_active()
 {
@@ -23,74 +23,308 @@ GameProgress GameState::has_active_round()
 
 bool GameState::want_to_write()
 {
-    return !pending_queue.empty();
+    return !pending_queue.empty() && !all_deferred;
 }
 
 void GameState::cycle()
 {
+    Trace::record(Trace::TICK_START, round.get_game_id(), round.history(false).size());
+    overload.tick(!drained);
+    all_deferred = false;
+    for (auto &p : players) {
+        p.sent_this_tick = 0;
+        p.shed_this_tick = false;
+    }
     round.recent_events = false;
     round.cycle();
-    if (round.recent_events) {
+    unflushed_events |= round.recent_events;
+    if (!std::get<1>(round.is_active())) {
+        // players passed over get the rest of the round although no tick follows
+        all_deferred = false;
+    }
+    // end of round goes out right away
+    if (unflushed_events && (++unflushed_ticks >= flush_ticks || !std::get<1>(round.is_active()))) {
         notify_players();
+        unflushed_events = false;
+        unflushed_ticks = 0;
     }
+    drained = pending_queue.empty();
+    Trace::record(Trace::TICK_END, round.get_game_id(), round.history(false).size());
 }
 
-size_t GameState::next_datagram(std::string &buffer, sockaddr_storage &addr)
+// player at the front of sending queue, players who left meanwhile are dropped from it and
+// those deferred under overload go to its back, nullptr if there is no one to send to now
+Player *GameState::pending_head()
 {
-    size_t i;
+    size_t i, deferred = 0;
     uint64_t player_id;
-    bool front_removed = false;
-   // std::cout << "Look up pending " << std::endl;
     while (!pending_queue.empty()) {
         player_id = pending_queue.front();
-        //std::cout << player_id << "" << std::endl;
         for (i = 0; i < players.size(); i++) {
             if (players[i].inner_id == player_id) {
                 break;
             }
         }
-        if (i < players.size()) {
+        if (i == players.size()) {
+            pop_pending_head();
+            continue;
+        }
+        if (!should_defer(players[i])) {
             break;
         }
-        pending.erase(pending_queue.front());
-        pending_queue.pop();
-        front_removed = true;
+        // everyone left has been passed over once
+        if (deferred++ == pending_queue.size()) {
+            all_deferred = drained = true;
+            return nullptr;
+        }
+        defer_pending_head(players[i]);
     }
     if (pending_queue.empty()) {
-        return 0;
+        drained = true;
+        return nullptr;
     }
-    //std::cerr << "Got here " << player_id << " " << players[i].expected_no << std::endl;
-    if (front_removed || !head_in_progress) {
+    Player &p = players[i];
+    if (!head_in_progress) {
         head_in_progress = true;
-        head_expected_no = players[i].expected_no;
-    }
-    auto &indxs = round.history_indx();
-    auto &hist = round.history();
-    //std::cerr << "Got ist tot here " << head_expected_no << " " << indxs.size() << std::endl;
-    if (head_expected_no >= indxs.size()) {
-        //std::cout << "Already satisfied"  << std::endl;
-        return 0;
-    }
-    size_t it = head_expected_no;
-    size_t mes_size = 0;
-    do {
-        mes_size += indxs[it] - ((it == 0)? 0 : indxs[it - 1]);
-        ++it;
-    } while (mes_size <= MAX_FROM_SERVER_DATAGRAM_SIZE - 4 && it < indxs.size());
+        head_expected_no = p.resume? std::max<size_t>(p.resume_no, p.expected_no) : p.expected_no;
+        p.resume = false;
+    }
+    head_batched = p.caps & Event::CAP_BATCH;
+    return &p;
+}
+
+void GameState::pop_pending_head()
+{
+    head_in_progress = false;
+    pending.erase(pending_queue.front());
+    pending_queue.pop();
+    drained |= pending_queue.empty();
+}
+
+bool GameState::far_behind(Player const &p)
+{
+    return p.expected_no + CATCH_UP_MIN_BEHIND <= round.history(p.caps & Event::CAP_BATCH).size();
+}
+
+// lurkers and players far behind, live updates of the others are never held back
+bool GameState::catching_up(Player const &p)
+{
+    return p.lurking || far_behind(p);
+}
+
+bool GameState::should_defer(Player const &p)
+{
+    // no tick comes after the last one of a round, so its end has to reach everyone right away
+    if (!std::get<1>(round.is_active())) {
+        return false;
+    }
+    switch (overload.current()) {
+        case OverloadControl::CAP_PLAYERS:
+            if (catching_up(p) && p.sent_this_tick >= OverloadControl::PLAYER_CAP) {
+                return true;
+            }
+            // fall through
+        case OverloadControl::DEFER_LURKERS:
+            if (p.lurking && far_behind(p)) {
+                return true;
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+// moves head to the back of the queue, remembering how far it got
+void GameState::defer_pending_head(Player &p)
+{
+    // head is deferred on every pass over the queue, shedding counts the player once per tick
+    if (!p.shed_this_tick) {
+        p.shed_this_tick = true;
+        if (overload.current() == OverloadControl::CAP_PLAYERS &&
+                p.sent_this_tick >= OverloadControl::PLAYER_CAP) {
+            overload.shed_capped();
+        }
+        else {
+            overload.shed_lurker();
+        }
+    }
+    if (head_in_progress) {
+        p.resume = true;
+        p.resume_no = head_expected_no;
+    }
+    head_in_progress = false;
+    pending_queue.pop();
+    pending_queue.push(p.inner_id);
+}
+
+// datagram for p starting at head_expected_no, false if there is nothing p lacks
+bool GameState::pack_datagram(Player &p, std::string &buffer)
+{
+    auto &hist = round.history(head_batched);
+    size_t budget = MAX_FROM_SERVER_DATAGRAM_SIZE - 4 - (p.extended? Event::CAPS_TRAILER_SIZE : 0) -
+            ((p.caps & Event::CAP_PREDICT)? Event::SNAKE_STATE_SIZE : 0);
     buffer = Event::serialize(round.get_game_id());
-    buffer.insert(buffer.size(), &hist[(head_expected_no == 0)? 0 : indxs[head_expected_no - 1]], mes_size);
-    addr = players[i].sockaddr;
-    //std::cerr << "Message to player number " << i << " " << head_expected_no << std::endl;
-    return it - head_expected_no;
+    if ((p.caps & Event::CAP_DEFLATE) && head_expected_no + DEFLATE_MIN_BEHIND <= hist.size()) {
+        head_next_no = pack_compressed(p, hist, head_expected_no, budget, buffer);
+    }
+    else {
+        head_next_no = pack_events(p, hist, head_expected_no, budget, buffer);
+    }
+    if (buffer.size() == 4 && !p.probing) {
+        return false;
+    }
+    if (p.extended) {
+        uint32_t mark = Event::CAPS_TRAILER_MARK;
+        buffer += Event::serialize(mark, p.caps);
+        if (p.caps & Event::CAP_PREDICT) {
+            buffer += snake_state(p).serialize();
+        }
+        p.probing = false;
+    }
+    return true;
+}
+
+Event::SnakeState GameState::snake_state(Player const &p)
+{
+    Event::SnakeState state;
+    SnakeArrays const &snakes = round.snake_state();
+    if (p.lurking || !std::get<1>(round.is_active()) || p.snake_id >= snakes.size() ||
+            snakes.eliminated[p.snake_id]) {
+        return state;
+    }
+    Board const &b = round.get_board();
+    size_t i = p.snake_id;
+    state.snake = i;
+    state.physics = static_cast<uint8_t>(b.physics);
+    state.direction = snakes.direction[i];
+    state.turning_speed = b.turning_speed;
+    state.game_speed = b.game_speed;
+    state.events = round.history(p.caps & Event::CAP_BATCH).size();
+    state.rtt = std::min<uint64_t>(p.latency.smoothed(), UINT32_MAX);
+    if (b.physics == Physics::FIXED) {
+        state.x = snakes.fx[i];
+        state.y = snakes.fy[i];
+    }
+    else {
+        memcpy(&state.x, &snakes.x[i], sizeof(state.x));
+        memcpy(&state.y, &snakes.y[i], sizeof(state.y));
+    }
+    return state;
+}
+
+bool GameState::next_datagram(std::string &buffer, sockaddr_storage &addr)
+{
+    size_t segment;
+    return next_burst(buffer, addr, 1, segment);
+}
+
+bool GameState::next_burst(std::string &buffer, sockaddr_storage &addr, size_t max_segments, size_t &segment)
+{
+    segment = 0;
+    head_segments = 1;
+    Player *p = pending_head();
+    if (p == nullptr) {
+        return false;
+    }
+    if (overload.current() == OverloadControl::CAP_PLAYERS && std::get<1>(round.is_active()) && catching_up(*p)) {
+        max_segments = std::min<size_t>(max_segments, OverloadControl::PLAYER_CAP - p->sent_this_tick);
+    }
+    if (!pack_datagram(*p, buffer)) {
+        pop_pending_head();
+        return false;
+    }
+    addr = p->sockaddr;
+    // legacy client would try to read padding as events
+    if (!p->extended) {
+        return true;
+    }
+    // following datagrams are packed as if the previous ones were sent, mark_sent commits them all
+    size_t first_no = head_expected_no, segments = 1;
+    std::string next;
+    while (segments < max_segments && head_next_no < round.history(head_batched).size()) {
+        size_t burst_next_no = head_next_no;
+        head_expected_no = head_next_no;
+        if (!pack_datagram(*p, next) || next.size() > MAX_FROM_SERVER_DATAGRAM_SIZE) {
+            head_next_no = burst_next_no;
+            break;
+        }
+        // client drops whatever follows caps trailer
+        buffer.resize(segments * MAX_FROM_SERVER_DATAGRAM_SIZE, '\0');
+        buffer += next;
+        ++segments;
+    }
+    head_expected_no = first_no;
+    head_segments = segments;
+    if (segments > 1) {
+        segment = MAX_FROM_SERVER_DATAGRAM_SIZE;
+    }
+    return true;
+}
+
+// appends events from given one on which fit in budget, skipping those player already holds,
+// at least one event is packed even if it's too long, returns number of the first one not packed
+size_t GameState::pack_events(Player &p, Event::History const &hist, size_t from, size_t budget,
+                              std::string &buffer)
+{
+    size_t packed = 0;
+    size_t it = p.skip_received(from);
+    while (it < hist.size()) {
+        size_t begin = hist.begin(it);
+        size_t mes_size = hist.positions[it] - begin;
+        if (packed > 0 && packed + mes_size > budget) {
+            break;
+        }
+        buffer.insert(buffer.size(), &hist.events[begin], mes_size);
+        packed += mes_size;
+        it = p.skip_received(it + 1);
+    }
+    return it;
+}
+
+// deflates as many events as fit in budget, halving the input until it does
+size_t GameState::pack_compressed(Player &p, Event::History const &hist, size_t from, size_t budget,
+                                  std::string &buffer)
+{
+    std::string raw, compressed;
+    for (size_t raw_budget = Event::MAX_INFLATED_SIZE; raw_budget > budget; raw_budget /= 2) {
+        raw.clear();
+        size_t next = pack_events(p, hist, from, raw_budget, raw);
+        if (raw.size() > raw_budget) {
+            break;
+        }
+        if (deflater.compress(raw, budget - Event::COMPRESSED_HEADER_SIZE, compressed)) {
+            uint32_t mark = Event::COMPRESSED_MARK;
+            uint16_t length = compressed.size();
+            buffer += Event::serialize(mark, length, compressed);
+            return next;
+        }
+    }
+    return pack_events(p, hist, from, budget, buffer);
 }
 
-void GameState::mark_sent(size_t events_no)
+void GameState::mark_sent()
 {
-    head_expected_no += events_no;
-    if (head_expected_no >= round.history_indx().size()) {
-        head_in_progress = false;
-        pending.erase(pending_queue.front());
-        pending_queue.pop();
+    Player *p = pending_head();
+    if (p != nullptr) {
+        p->sent(head_next_no, monotonic_microseconds());
+        p->sent_this_tick += head_segments;
+    }
+    head_expected_no = head_next_no;
+    if (head_expected_no >= round.history(head_batched).size()) {
+        pop_pending_head();
+    }
+}
+
+void GameState::report_latency(std::ostream &out)
+{
+    size_t history_size = round.history(false).size(), batched_size = round.history(true).size();
+    for (auto &p : players) {
+        size_t size = (p.caps & Event::CAP_BATCH)? batched_size : history_size;
+        LatencyStats const &l = p.latency;
+        out << "player " << (p.name.length()? p.name : "-") << " session " << p.session_id
+            << " rtt " << l.smoothed() << " us var " << l.variation() << " us p50 " << l.percentile(0.5)
+            << " p90 " << l.percentile(0.9) << " p99 " << l.percentile(0.99) << " samples " << l.count()
+            << " behind " << (size > p.expected_no? size - p.expected_no : 0) << std::endl;
     }
 }
 
@@ -102,6 +336,12 @@ void GameState::got_message(std::string &buffer, sockaddr_storage &addr, uint64_
         std::cerr << "Dropping incorrect message" << std::endl;
         return;
     }
+    got_event(e, addr, rec_time);
+}
+
+void GameState::got_event(Event::ClientEvent const &e, sockaddr_storage &addr, uint64_t rec_time)
+{
+    Trace::record(Trace::RECEIVED, e.session_id, e.next_expected_event_no);
     disconnect_inactive(rec_time);
     connect_or_update_player(e, addr, rec_time);
     update_game_state_on_player_message();
@@ -121,12 +361,12 @@ void GameState::disconnect_inactive(uint64_t threshold)
 
 void GameState::disconnect_player(size_t id)
 {
+    Trace::record(Trace::DISCONNECTED, players[id].session_id, players[id].inner_id);
     reserved_names.erase(players[id].name);
     if (id < players.size() - 1) {
         std::swap(players[id], players[players.size() - 1]);
     }
     players.pop_back();
-    //std::cerr << "Disconnected player" << std::endl;
 }
 
 void GameState::notify_player(Player &p)
@@ -134,6 +374,7 @@ void GameState::notify_player(Player &p)
     auto inserted = pending.insert(p.inner_id);
     if (inserted.second) {
         pending_queue.push(p.inner_id);
+        all_deferred = false;
     }
 }
 
@@ -154,7 +395,7 @@ void GameState::connect_player(
         return;
     }
     players.push_back(Player{e, addr, rec_time, inner_counter++});
-    //std::cerr << "Connected new player" << std::endl;
+    Trace::record(Trace::CONNECTED, e.session_id, players.back().inner_id);
     notify_player(players[players.size() - 1]);
 }
 
@@ -175,7 +416,9 @@ void GameState::connect_or_update_player(
         } else {
             //std::cerr << "Message from player number " << i << std::endl;
             p.last_contact = rec_time;
+            p.acknowledged(e.next_expected_event_no, monotonic_microseconds());
             p.expected_no = e.next_expected_event_no;
+            p.negotiate(e);
             p.last_turn_direction = e.turn_direction;
             p.pressed_arrow |= (e.turn_direction != 0);
             if (!p.lurking && std::get<1>(round.is_active())) {
@@ -225,6 +468,7 @@ void GameState::start_new_round()
     std::vector<EagerPlayer> eager;
     size_t i = 0;
     for (auto &p : players) {
+        p.new_round();
         if (p.name.length() && p.pressed_arrow) {
             eager.push_back(EagerPlayer{p.name, p.last_turn_direction, i});
         }
@@ -233,7 +477,7 @@ void GameState::start_new_round()
     std::sort(eager.begin(), eager.end());
     // restrict number of players so that their names fit in single datagram
     size_t fitting_no = 0;
-    uint32_t slen = 28; //it's overhead of additional data
+    uint32_t slen = 28 + Event::CAPS_TRAILER_SIZE + Event::SNAKE_STATE_SIZE; //it's overhead of additional data
     for (auto &e : eager) {
         slen += std::get<0>(e).length() + 1;
         if (slen > MAX_FROM_SERVER_DATAGRAM_SIZE) {
@@ -253,37 +497,141 @@ void GameState::start_new_round()
     decltype(pending_queue) empty_pendign_queue;
     std::swap(pending_queue, empty_pendign_queue);
     head_in_progress = false;
+    all_deferred = false;
     pending.clear();
-    round = Round{board, eager};
+    if (round_replaced && std::get<0>(round.is_active())) {
+        round_replaced(round.history(false), round.get_game_id());
+    }
+    round.start(board, eager, random);
+}
+
+Event::History const &GameState::round_history()
+{
+    return round.history(false);
+}
+
+uint32_t GameState::round_game_id()
+{
+    return round.get_game_id();
+}
+
+void GameState::on_round_replaced(std::function<void(Event::History const &, uint32_t)> f)
+{
+    round_replaced = f;
 }
 
 Player::Player(Event::ClientEvent const &e, sockaddr_storage &addr, uint64_t rec_time,
                uint64_t inner_id)
         : lurking{true}, pressed_arrow{e.turn_direction != 0}, last_turn_direction{e.turn_direction},
           name{e.player_name}, inner_id{inner_id}, expected_no{e.next_expected_event_no},
-          last_contact{rec_time}, sockaddr{addr}, session_id{e.session_id} {}
+          last_contact{rec_time}, sockaddr{addr}, session_id{e.session_id}, first_sent_until{0},
+          sent_this_tick{0}, shed_this_tick{false}, resume{false}, resume_no{0}
+{
+    negotiate(e);
+}
 
-Player::Player() = default;
+Player::Player() : first_sent_until{0}, sent_this_tick{0}, shed_this_tick{false}, resume{false}, resume_no{0} {}
 
-Round::Round() = default;
+void Player::negotiate(Event::ClientEvent const &e)
+{
+    extended = e.extended;
+    probing = e.caps & Event::CAP_PROBE;
+    caps = e.caps & SERVER_CAPS;
+    received.clear();
+    if (caps & Event::CAP_SACK) {
+        received = e.received;
+        std::sort(received.begin(), received.end());
+    }
+}
 
-Round::Round(Board &board, std::vector<EagerPlayer> &eager)
-        : board{board}, game_id{r.next()}, eliminated{0}, round_finished{false}, recent_events{false},
-          game_over_raised{false}
+void Player::sent(uint32_t end, uint64_t now)
 {
+    if (end <= first_sent_until) {
+        return;
+    }
+    first_sent_until = end;
+    if (sent_marks.size() == MAX_SENT_MARKS) {
+        sent_marks.pop_front();
+    }
+    sent_marks.push_back(SendMark{end, now});
+}
+
+// the latest send covered gives the sample, older ones waited for the heartbeat longer
+void Player::acknowledged(uint32_t expected_no, uint64_t now)
+{
+    if (sent_marks.empty() || sent_marks.front().end > expected_no) {
+        return;
+    }
+    uint64_t time = 0;
+    while (!sent_marks.empty() && sent_marks.front().end <= expected_no) {
+        time = sent_marks.front().time;
+        sent_marks.pop_front();
+    }
+    latency.add(now - time);
+}
+
+void Player::new_round()
+{
+    sent_marks.clear();
+    first_sent_until = 0;
+    resume = false;
+}
+
+// first event at or after event_no that player doesn't hold yet
+size_t Player::skip_received(size_t event_no)
+{
+    for (auto &r : received) {
+        if (r.first <= event_no && event_no < r.second) {
+            event_no = r.second;
+        }
+    }
+    return event_no;
+}
+
+Round::Round()
+        : game_id{0}, eliminated{0}, round_finished{false}, batching{false}, recent_events{false},
+          game_over_raised{false} {}
+
+void Round::start(Board const &new_board, std::vector<EagerPlayer> const &eager, Generator &r)
+{
+    // previous round tells how much history to expect, first one guesses from board size
+    size_t expected_events = std::max<uint64_t>(
+            events_history.size(), std::min<uint64_t>(MAX_RESERVED_EVENTS,
+                    static_cast<uint64_t>(eager.size()) * (new_board.maxx + new_board.maxy)));
+    size_t expected_batches = std::max<size_t>(
+            batched_history.size(), expected_events / std::max<size_t>(1, eager.size()));
+    board = new_board;
+    game_id = r.next();
+    eliminated = 0;
+    round_finished = false;
+    recent_events = false;
+    game_over_raised = false;
+    batching = false;
+    batch.steps.clear();
+    taken_pxls.reset(board, expected_events);
+    snakes.clear();
+    names.clear();
+    events_history.clear();
+    batched_history.clear();
+    // pixel event takes 22 bytes, batch 13 bytes and 2 bytes per pixel
+    events_history.reserve(expected_events, expected_events * 22);
+    batched_history.reserve(expected_batches, expected_batches * 13 + expected_events * 2);
     for (auto &ep : eager) {
-        snakes.push_back(Snake{std::get<0>(ep), std::get<1>(ep), board});
+        uint32_t x = r.next() % board.maxx;
+        uint32_t y = r.next() % board.maxy;
+        int32_t direction = r.next() % 360;
+        snakes.push_back(x, y, direction, std::get<1>(ep));
+        names.push_back(std::get<0>(ep));
     }
     new_game();
-    size_t i = 0;
-    for (auto &s : snakes) {
-        register_move(s.position(), s, i++);
+    for (size_t i = 0; i < snakes.size(); ++i) {
+        register_move(position(i), i);
     }
 }
 
 void Round::direction(size_t snake_id, uint32_t direction)
 {
-    snakes[snake_id].last_turn_direction = direction;
+    snakes.last_turn_direction[snake_id] = direction;
 }
 
 uint32_t Round::get_game_id()
@@ -291,28 +639,17 @@ uint32_t Round::get_game_id()
     return game_id;
 }
 
-std::vector<char> const &Round::history()
-{
-    return events_history;
-}
-
-std::vector<size_t> const &Round::history_indx()
+Event::History const &Round::history(bool batched)
 {
-    return events_positions;
+    return batched? batched_history : events_history;
 }
 
 void Round::event(Event::SerializableEvent &e)
 {
     recent_events = true;
-    std::string es = e.serialize();
-    uint32_t length = es.length() + 4;
-    uint32_t event_no = events_positions.size();
-    std::string s = Event::serialize(length, event_no, es);
-    uint32_t crc = crc32(0, reinterpret_cast<unsigned char *>(&s[0]), s.length());
-    s.resize(s.length() + 4);
-    *reinterpret_cast<uint32_t *>(&s[s.length() - 4]) = bswap(crc);
-    events_history.insert(events_history.end(), s.begin(), s.end());
-    events_positions.push_back(events_history.size());
+    flush_batch();
+    events_history.append(e);
+    batched_history.append(e);
 }
 
 void Round::new_game()
@@ -321,8 +658,8 @@ void Round::new_game()
     e.maxx = board.maxx;
     e.maxy = board.maxy;
     std::stringstream ss;
-    for (auto &snake : snakes) {
-        ss << snake.name << " ";
+    for (auto &name : names) {
+        ss << name << " ";
     }
     e.player_names = ss.str();
     event(e);
@@ -334,14 +671,33 @@ void Round::game_over()
     event(e);
 }
 
-void Round::pixel(Snake &s, size_t player)
+void Round::flush_batch()
+{
+    if (!batch.steps.empty()) {
+        batched_history.append(batch);
+        batch.steps.clear();
+    }
+}
+
+// pixel is reported relative to the one registered before, so it has to be called
+// before snake's registered pixel changes
+void Round::pixel(Position const &p, size_t player)
 {
     Event::Pixel e;
-    Position p = s.position();
     e.x = std::get<0>(p);
     e.y = std::get<1>(p);
     e.player_number = player;
-    event(e);
+    recent_events = true;
+    events_history.append(e);
+    int64_t dx = static_cast<int64_t>(e.x) - snakes.px[player];
+    int64_t dy = static_cast<int64_t>(e.y) - snakes.py[player];
+    if (batching && std::abs(dx) <= 1 && std::abs(dy) <= 1) {
+        batch.add(e.player_number, dx, dy);
+    }
+    else {
+        flush_batch();
+        batched_history.append(e);
+    }
 }
 
 void Round::player_eliminated(size_t player)
@@ -352,15 +708,15 @@ void Round::player_eliminated(size_t player)
 }
 
 
-void Round::register_move(Position const &new_position, Snake &s, size_t player)
+void Round::register_move(Position const &new_position, size_t player)
 {
     if (std::get<0>(new_position) < board.maxx && std::get<1>(new_position) < board.maxy &&
-            board.taken_pxls.insert(new_position).second) {
-        pixel(s, player);
+            taken_pxls.insert(new_position)) {
+        pixel(new_position, player);
     }
     else {
         player_eliminated(player);
-        s.eliminated = true;
+        snakes.eliminated[player] = true;
         ++eliminated;
         if (snakes.size() - eliminated <= 1) {
             game_over();
@@ -370,43 +726,291 @@ void Round::register_move(Position const &new_position, Snake &s, size_t player)
     }
 }
 
-void Round::move(Snake &s, size_t player)
+// movement of all snakes doesn't depend on each other, so they are moved together first
+// and then their moves are registered in player order
+void Round::cycle()
 {
-    auto old_position = s.position();
-    s.direction += 360 + s.last_turn_direction * board.turning_speed;
-    s.direction %= 360;
-    s.x += cos(M_PI * s.direction / 180.);
-    s.y += sin(M_PI * s.direction / 180.);
-    auto new_position = s.position();
-    if (old_position != new_position) {
-        register_move(new_position, s, player);
+    if (round_finished) {
+        return;
     }
+    advance_snakes(snakes, board.turning_speed, board.physics);
+    batching = true;
+    for (size_t player = 0; player < snakes.size() && !round_finished; ++player) {
+        if (snakes.eliminated[player]) {
+            continue;
+        }
+        Position p = position(player);
+        if (p != Position{snakes.px[player], snakes.py[player]}) {
+            register_move(p, player);
+            snakes.px[player] = std::get<0>(p);
+            snakes.py[player] = std::get<1>(p);
+        }
+    }
+    batching = false;
+    flush_batch();
 }
 
-void Round::cycle()
+Board::Board() : game_speed{0}, turning_speed{0}, maxx{0}, maxy{0}, physics{} {}
+
+PixelSet::PixelSet() : dense{true}, maxx{0} {}
+
+void PixelSet::reset(Board const &board, size_t expected_pixels)
 {
-    size_t player = 0;
-    for (auto &snake: snakes) {
-        if (!snake.eliminated && !round_finished) {
-            move(snake, player);
-        }
-        player++;
+    uint64_t area = static_cast<uint64_t>(board.maxx) * board.maxy;
+    dense = area <= MAX_DENSE_PIXELS;
+    maxx = board.maxx;
+    if (dense) {
+        bits.assign((area + 63) / 64, 0);
+    }
+    else {
+        sparse.clear();
+        sparse.reserve(expected_pixels);
     }
 }
 
-Board::Board() = default;
+bool PixelSet::insert(Position const &p)
+{
+    if (!dense) {
+        return sparse.insert(p).second;
+    }
+    uint64_t i = static_cast<uint64_t>(std::get<1>(p)) * maxx + std::get<0>(p);
+    uint64_t mask = UINT64_C(1) << (i % 64);
+    if (bits[i / 64] & mask) {
+        return false;
+    }
+    bits[i / 64] |= mask;
+    return true;
+}
 
-Board::Board(uint32_t gs, uint32_t ts, uint32_t mx, uint32_t my)
-        : game_speed{gs}, turning_speed{ts}, maxx{mx}, maxy{my} {}
+bool PixelSet::contains(Position const &p) const
+{
+    if (!dense) {
+        return sparse.count(p) > 0;
+    }
+    uint64_t i = static_cast<uint64_t>(std::get<1>(p)) * maxx + std::get<0>(p);
+    return bits[i / 64] & (UINT64_C(1) << (i % 64));
+}
+
+Board::Board(uint32_t gs, uint32_t ts, uint32_t mx, uint32_t my, Physics physics)
+        : game_speed{gs}, turning_speed{ts}, maxx{mx}, maxy{my}, physics{physics} {}
 
-Round::Snake::Snake(std::string name, int32_t direction, Board const &board)
-        : eliminated{false}, x{r.next() % board.maxx + 0.5}, y{r.next() % board.maxy + 0.5},
-          direction{static_cast<int32_t>(r.next() % 360)}, last_turn_direction{direction},
-          name{name}
+Board const &Round::get_board() const
 {
+    return board;
+}
 
-};
+SnakeArrays const &Round::snake_state() const
+{
+    return snakes;
+}
+
+bool Round::is_taken(Position const &p) const
+{
+    return std::get<0>(p) >= board.maxx || std::get<1>(p) >= board.maxy || taken_pxls.contains(p);
+}
 
-Position Round::Snake::position() {
-    return Position{static_cast<uint32_t>(x), static_cast<uint32_t>(y)};
+Position Round::position(size_t player) {
+    uint32_t x, y;
+    snake_pixel(snakes, player, board.physics, x, y);
+    return Position{x, y};
+}
+
+void Round::save(SnapshotWriter &out) const
+{
+    // taken between cycles, so there is no batch in progress
+    out.put(board.game_speed);
+    out.put(board.turning_speed);
+    out.put(board.maxx);
+    out.put(board.maxy);
+    out.put(board.physics);
+    out.put(game_id);
+    out.put(snakes.x);
+    out.put(snakes.y);
+    out.put(snakes.fx);
+    out.put(snakes.fy);
+    out.put(snakes.direction);
+    out.put(snakes.last_turn_direction);
+    out.put(snakes.px);
+    out.put(snakes.py);
+    out.put(snakes.eliminated);
+    out.put(names);
+    out.put<uint64_t>(eliminated);
+    out.put(round_finished);
+    out.put(recent_events);
+    out.put(game_over_raised);
+    out.put(events_history.events);
+    out.put(events_history.positions);
+    out.put(batched_history.events);
+    out.put(batched_history.positions);
+}
+
+bool Round::load(SnapshotReader &in)
+{
+    uint64_t eliminated_no;
+    in.get(board.game_speed);
+    in.get(board.turning_speed);
+    in.get(board.maxx);
+    in.get(board.maxy);
+    in.get(board.physics);
+    in.get(game_id);
+    in.get(snakes.x);
+    in.get(snakes.y);
+    in.get(snakes.fx);
+    in.get(snakes.fy);
+    in.get(snakes.direction);
+    in.get(snakes.last_turn_direction);
+    in.get(snakes.px);
+    in.get(snakes.py);
+    in.get(snakes.eliminated);
+    in.get(names);
+    in.get(eliminated_no);
+    in.get(round_finished);
+    in.get(recent_events);
+    in.get(game_over_raised);
+    in.get(events_history.events);
+    in.get(events_history.positions);
+    in.get(batched_history.events);
+    in.get(batched_history.positions);
+    eliminated = eliminated_no;
+    batching = false;
+    batch.steps.clear();
+
+    size_t n = snakes.size();
+    // round that never started has an empty board and nothing in history
+    bool consistent = in.ok() && board.physics <= Physics::FIXED &&
+            (n > 0? board.maxx > 0 && board.maxy > 0 : events_history.size() == 0 && batched_history.size() == 0) &&
+            snakes.x.size() == n && snakes.y.size() == n && snakes.fx.size() == n &&
+            snakes.fy.size() == n && snakes.direction.size() == n && snakes.last_turn_direction.size() == n &&
+            snakes.px.size() == n && snakes.py.size() == n && snakes.eliminated.size() == n &&
+            names.size() == n && eliminated <= n;
+    for (auto hist : {&events_history, &batched_history}) {
+        size_t end = 0;
+        for (size_t i = 0; consistent && i < hist->size(); ++i) {
+            consistent = hist->positions[i] >= end + 12 && hist->positions[i] <= hist->events.size();
+            end = hist->positions[i];
+        }
+        consistent = consistent && end == hist->events.size();
+    }
+    if (!consistent) {
+        return false;
+    }
+
+    // pixels are the only events taking space on board
+    taken_pxls.reset(board, events_history.size());
+    for (size_t i = 0; i < events_history.size(); ++i) {
+        char const *e = &events_history.events[events_history.begin(i)];
+        if (e[8] == 1 && events_history.positions[i] - events_history.begin(i) == 22) {
+            Position p{Event::parse<uint32_t>(e + 10), Event::parse<uint32_t>(e + 14)};
+            if (std::get<0>(p) < board.maxx && std::get<1>(p) < board.maxy) {
+                taken_pxls.insert(p);
+            }
+        }
+    }
+    return true;
+}
+
+std::string GameState::snapshot() const
+{
+    SnapshotWriter out;
+    out.put(SNAPSHOT_MAGIC);
+    out.put(inner_counter);
+    out.put(random.state());
+    out.put(flush_ticks);
+    out.put<uint64_t>(players.size());
+    for (auto &p : players) {
+        out.put(p.lurking);
+        out.put(p.pressed_arrow);
+        out.put(p.last_turn_direction);
+        out.put(p.name);
+        out.put(p.inner_id);
+        out.put(p.expected_no);
+        out.put(p.last_contact);
+        out.put<uint64_t>(p.snake_id);
+        out.put(p.extended);
+        out.put(p.probing);
+        out.put(p.caps);
+        out.put<uint64_t>(p.received.size());
+        for (auto &r : p.received) {
+            out.put(r.first);
+            out.put(r.second);
+        }
+        out.put(p.sockaddr);
+        out.put(p.session_id);
+    }
+    round.save(out);
+    return out.str();
+}
+
+bool GameState::restore(std::string const &snapshot)
+{
+    SnapshotReader in(snapshot);
+    uint32_t magic, seed, restored_flush_ticks;
+    uint64_t counter, players_no;
+    in.get(magic);
+    in.get(counter);
+    in.get(seed);
+    in.get(restored_flush_ticks);
+    in.get(players_no);
+    if (!in.ok() || magic != SNAPSHOT_MAGIC || players_no > MAX_PLAYERS) {
+        return false;
+    }
+    std::vector<Player> restored(players_no);
+    for (auto &p : restored) {
+        uint64_t snake_id, ranges;
+        in.get(p.lurking);
+        in.get(p.pressed_arrow);
+        in.get(p.last_turn_direction);
+        in.get(p.name);
+        in.get(p.inner_id);
+        in.get(p.expected_no);
+        in.get(p.last_contact);
+        in.get(snake_id);
+        in.get(p.extended);
+        in.get(p.probing);
+        in.get(p.caps);
+        in.get(ranges);
+        p.snake_id = snake_id;
+        if (ranges > Event::MAX_SACK_RANGES) {
+            return false;
+        }
+        for (uint64_t i = 0; i < ranges; ++i) {
+            Event::EventRange r;
+            in.get(r.first);
+            in.get(r.second);
+            p.received.push_back(r);
+        }
+        in.get(p.sockaddr);
+        in.get(p.session_id);
+    }
+    Round restored_round;
+    if (!in.ok() || !restored_round.load(in)) {
+        return false;
+    }
+    for (auto &p : restored) {
+        if (!p.lurking && p.snake_id >= restored_round.snake_state().size()) {
+            return false;
+        }
+    }
+    // round in progress goes on with the timer of this process, it has to tick as before
+    if (std::get<1>(restored_round.is_active()) &&
+            (restored_round.get_board().game_speed != board.game_speed || restored_flush_ticks != flush_ticks)) {
+        return false;
+    }
+
+    players = std::move(restored);
+    reserved_names.clear();
+    for (auto &p : players) {
+        if (p.name.length()) {
+            reserved_names.insert(p.name);
+        }
+    }
+    inner_counter = counter;
+    random = Generator(seed);
+    round = std::move(restored_round);
+    pending_queue = std::queue<uint64_t>();
+    pending.clear();
+    head_in_progress = false;
+    // everyone gets what they lack from the new process
+    notify_players();
+    return true;
 }
@@ -8,11 +8,19 @@
 #include <ctime>
 #include <tuple>
 #include <queue>
+#include <deque>
+#include <functional>
+#include <ostream>
 #include <cmath>
 #include <zlib.h>
 #include "utils.h"
 #include "events.h"
 #include "generator.h"
+#include "movement.h"
+#include "compression.h"
+#include "snapshot.h"
+#include "latency.h"
+#include "overload.h"
 
 using Position = std::tuple<uint32_t, uint32_t>;
 using GameProgress = std::tuple<bool, bool>;
@@ -43,64 +51,85 @@ struct HashTuple {
 uint32_t const TWOTO16 = 65536;
 uint64_t const TWOTO32 = 4294967296L;
 size_t const MAX_PLAYERS = 42;
-uint64_t const INACTIVITY_TOLERANCE = 2000;
+uint8_t const SERVER_CAPS = Event::CAP_SACK | Event::CAP_BATCH | Event::CAP_DEFLATE | Event::CAP_PREDICT;
+size_t const DEFLATE_MIN_BEHIND = 32; //events a player lacks before datagrams get compressed
+size_t const MAX_SENT_MARKS = 64; //first sends per player awaiting acknowledgement
+size_t const CATCH_UP_MIN_BEHIND = 32; //events a player lacks before its sending can be held back
 
-extern Generator r;
+size_t const MAX_DENSE_PIXELS = 1 << 27; //boards up to this area keep taken pixels in a bitmap
+size_t const MAX_RESERVED_EVENTS = 1 << 20;
+uint64_t const ROUND_DRAWS = 1 + 3 * MAX_PLAYERS; //game id and position and direction of every snake
 
 struct Board {
     uint32_t game_speed, turning_speed;
     uint32_t maxx, maxy;
-    std::unordered_set<Position, HashTuple<uint32_t, uint32_t>::Hash<TWOTO16, 1>> taken_pxls;
+    Physics physics;
 
-    Board(uint32_t, uint32_t, uint32_t, uint32_t);
+    Board(uint32_t, uint32_t, uint32_t, uint32_t, Physics);
     Board();
 };
 
-class Round {
-    struct Snake {
-        bool eliminated;
-        double x, y; // current position on board
-        int32_t direction; //current direction snake will move in
-        int32_t last_turn_direction; //last valid turn_direction:{-1,0,1} submitted by player
-        std::string name; //associated player name
-
-        Snake(std::string name, int32_t, Board const &);
-        Position position();
-    };
+/* Taken pixels of a round, storage is kept when cleared for the next round */
+class PixelSet {
+    bool dense;
+    uint32_t maxx;
+    std::vector<uint64_t> bits;
+    std::unordered_set<Position, HashTuple<uint32_t, uint32_t>::Hash<TWOTO16, 1>> sparse;
+
+public:
+    PixelSet();
+    void reset(Board const &board, size_t expected_pixels);
+    bool insert(Position const &p); //p has to be on board, true if it wasn't taken
+    bool contains(Position const &p) const; //p has to be on board
+};
 
+class Round {
     Board board;
     uint32_t game_id;
+    PixelSet taken_pxls;
 
-    /* Snakes */
-    std::vector<Snake> snakes;
+    /* Snakes, names of associated players are kept apart from the hot state */
+    SnakeArrays snakes;
+    std::vector<std::string> names;
     size_t eliminated;
 
-    /* History */
+    /* History, batched one has pixels registered within a tick in a single event */
     bool round_finished;
-    std::vector<char> events_history;
-    std::vector<size_t> events_positions;
+    Event::History events_history, batched_history;
+    bool batching;
+    Event::PixelBatch batch;
 
 public:
-    Round(Board &board, std::vector<EagerPlayer> &eager);
     Round();
+    // starts next round reusing storage of the previous one, takes ROUND_DRAWS at most from r
+    void start(Board const &board, std::vector<EagerPlayer> const &eager, Generator &r);
 
     bool recent_events, game_over_raised;
 
     uint32_t get_game_id();
     GameProgress is_active();
-    std::vector<char> const &history();
-    std::vector<size_t> const &history_indx();
+    Event::History const &history(bool batched);
 
     /* Events generators */
     void event(Event::SerializableEvent &e);
+    void flush_batch();
     void new_game();
     void game_over();
-    void pixel(Snake &s, size_t player);
+    void pixel(Position const &p, size_t player);
     void player_eliminated(size_t player);
-    void register_move(Position const &new_position, Snake &s, size_t player);
-    void move(Snake &s, size_t player);
+    void register_move(Position const &new_position, size_t player);
+    Position position(size_t player);
     void direction(size_t snake_id, uint32_t direction);
     void cycle();
+
+    /* Read only view, e.g. for bots */
+    Board const &get_board() const;
+    SnakeArrays const &snake_state() const;
+    bool is_taken(Position const &p) const; //true also for pixels off board
+
+    /* Taking over by another process, taken pixels are rebuilt from history */
+    void save(SnapshotWriter &out) const;
+    bool load(SnapshotReader &in);
 };
 
 
@@ -114,11 +143,40 @@ struct Player {
     uint64_t last_contact;
     size_t snake_id; //every non-lurking player has their snake during round
 
+    /* Negotiated protocol extensions */
+    bool extended; //player gets capabilities trailer in every datagram
+    bool probing; //player waits for capabilities acknowledgement
+    uint8_t caps;
+    std::vector<Event::EventRange> received; //sorted ranges player holds beyond expected_no
+
     /* socket address and session_id identifies player over the net */
     sockaddr_storage sockaddr;
     uint64_t session_id;
+
+    /* Round trips from the first send of events to the message with next expected number past
+     * them, retransmissions aren't sampled as it's unknown which copy arrived */
+    struct SendMark {
+        uint32_t end; //events before it were sent for the first time at time
+        uint64_t time;
+    };
+    std::deque<SendMark> sent_marks;
+    uint32_t first_sent_until; //events before it were sent at least once this round
+    LatencyStats latency;
+
+    /* Sending under overload */
+    uint32_t sent_this_tick; //datagrams
+    bool shed_this_tick; //already counted as passed over in this tick
+    bool resume; //player was passed over in the middle of sending, goes on from resume_no
+    size_t resume_no;
+
     Player(Event::ClientEvent const &e, sockaddr_storage &addr, uint64_t rec_time, uint64_t inner);
     Player();
+
+    void negotiate(Event::ClientEvent const &e);
+    size_t skip_received(size_t event_no);
+    void sent(uint32_t end, uint64_t now);
+    void acknowledged(uint32_t expected_no, uint64_t now);
+    void new_round();
 };
 
 class GameState {
@@ -137,24 +195,73 @@ class GameState {
     /* Sending queue */
     std::queue<uint64_t> pending_queue;
     std::unordered_set<uint64_t> pending;
-    bool head_in_progress;
+    bool head_in_progress, head_batched;
     size_t head_expected_no;
+    size_t head_next_no; //head_expected_no after datagram returned by next_datagram is sent
+    size_t head_segments; //datagrams in the buffer returned by next_burst
+
+    /* Shedding when send work of a tick isn't done before the next one */
+    OverloadControl overload;
+    bool drained; //sending queue had nothing to send at some point since the last tick
+    bool all_deferred; //everything queued waits for the next tick
+
+    /* Events of several ticks go out together */
+    uint32_t flush_ticks; //ticks between notifying players
+    uint32_t unflushed_ticks; //ticks since players were notified
+    bool unflushed_events;
+
+    Deflater deflater;
 
     void notify_player(Player &p);
     void notify_players();
+    Player *pending_head();
+    void pop_pending_head();
+    bool far_behind(Player const &p);
+    bool catching_up(Player const &p);
+    bool should_defer(Player const &p);
+    void defer_pending_head(Player &p);
+    bool pack_datagram(Player &p, std::string &buffer);
+    Event::SnakeState snake_state(Player const &p);
+    size_t pack_events(Player &p, Event::History const &hist, size_t from, size_t budget,
+                       std::string &buffer);
+    size_t pack_compressed(Player &p, Event::History const &hist, size_t from, size_t budget,
+                           std::string &buffer);
 
     /* Round */
     Board board;
+    Generator random;
     Round round;
+    std::function<void(Event::History const &, uint32_t)> round_replaced;
     void start_new_round();
 
 public:
-    GameState(uint32_t seed, uint32_t gs, uint32_t ts, uint32_t mx, uint32_t my);
+    // players are notified of new events once per flush_ms (every tick if that's shorter)
+    GameState(uint32_t seed, uint32_t gs, uint32_t ts, uint32_t mx, uint32_t my, Physics physics,
+              uint32_t flush_ms);
     void got_message(std::string &buffer, sockaddr_storage &addr, uint64_t rec_time);
+    // same as got_message for event already parsed, e.g. by another thread
+    void got_event(Event::ClientEvent const &e, sockaddr_storage &addr, uint64_t rec_time);
     void cycle();
     GameProgress has_active_round();
-    size_t next_datagram(std::string &buffer, sockaddr_storage &addr);
-    void mark_sent(size_t events_no);
+    bool next_datagram(std::string &buffer, sockaddr_storage &addr);
+    /* Up to max_segments datagrams for the same player in one buffer, each but the last padded
+     * to segment bytes; segment is 0 if buffer holds a single datagram */
+    bool next_burst(std::string &buffer, sockaddr_storage &addr, size_t max_segments, size_t &segment);
+    void mark_sent();
     bool want_to_write();
+    // line per player with round trip estimates and how many events they lack
+    void report_latency(std::ostream &out);
+
+    /* Round as it is, for streams served apart from the players */
+    Event::History const &round_history();
+    uint32_t round_game_id();
+    // f gets history and game id of every round just before the next one replaces it
+    void on_round_replaced(std::function<void(Event::History const &, uint32_t)> f);
+
+    /* Live handoff to a new server process, board set up at construction is kept for
+     * the rounds after the restored one. Round in progress is restored only if this process
+     * ticks and flushes at the same rate. */
+    std::string snapshot() const;
+    bool restore(std::string const &snapshot);
 };
 #endif //II_GAME_STATE_H
@@ -7,3 +7,18 @@ uint32_t Generator::next() {
     r = (r * GEN) % MOD;
     return old_r;
 }
+
+void Generator::jump(uint64_t steps) {
+    uint64_t multiplier = 1, power = GEN;
+    for (; steps > 0; steps >>= 1) {
+        if (steps & 1) {
+            multiplier = (multiplier * power) % MOD;
+        }
+        power = (power * power) % MOD;
+    }
+    r = (r * multiplier) % MOD;
+}
+
+uint32_t Generator::state() const {
+    return r;
+}
@@ -12,6 +12,10 @@ public:
     Generator(uint32_t);
 
     uint32_t next();
+    // same as calling next steps times, in O(log steps)
+    void jump(uint64_t steps);
+    // Generator(state()) continues the same sequence
+    uint32_t state() const;
 };
 
 #endif //SIECI_II_GENERATOR_H
@@ -0,0 +1,32 @@
+#include <netinet/udp.h>
+#include "gso.h"
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+bool gso_supported(int sock)
+{
+    int segment = 0;
+    socklen_t len = sizeof(segment);
+    return getsockopt(sock, IPPROTO_UDP, UDP_SEGMENT, &segment, &len) == 0;
+}
+
+ssize_t send_segmented(int sock, std::string const &buffer, uint16_t segment, sockaddr_storage const &addr)
+{
+    iovec iov = {const_cast<char *>(buffer.data()), buffer.size()};
+    char control[CMSG_SPACE(sizeof(uint16_t))] = {};
+    msghdr msg = {};
+    msg.msg_name = const_cast<sockaddr_storage *>(&addr);
+    msg.msg_namelen = sizeof(addr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = IPPROTO_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+    return sendmsg(sock, &msg, 0);
+}
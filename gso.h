@@ -0,0 +1,18 @@
+#ifndef II_GSO_H
+#define II_GSO_H
+
+#include <string>
+#include "utils.h"
+
+/* UDP generic segmentation offload, the kernel splits one buffer into datagrams of a fixed size
+ * (only the last one may be shorter) */
+
+size_t const MAX_GSO_SEGMENTS = 64; // kernel limit, newer kernels allow more
+
+// true if kernel knows UDP_SEGMENT for the socket
+bool gso_supported(int sock);
+
+// sends buffer as consecutive datagrams of segment bytes each, result as of sendto
+ssize_t send_segmented(int sock, std::string const &buffer, uint16_t segment, sockaddr_storage const &addr);
+
+#endif //II_GSO_H
@@ -0,0 +1,31 @@
+#ifndef II_GUI_PROTOCOL_H
+#define II_GUI_PROTOCOL_H
+
+#include <cstdint>
+#include <cstddef>
+
+/* Binary framing of what the client sends to GUI, chosen with client's -b in place of text
+ * lines. Numbers are in network byte order as in the game protocol, players are indices into
+ * the names of the last NEW_GAME. Key commands from GUI stay text lines.
+ *   NEW_GAME           type, maxx (4), maxy (4), players (1), then every name as length (1)
+ *                      and characters
+ *   PIXEL              type, player (1), x (4), y (4)
+ *   PLAYER_ELIMINATED  type, player (1)
+ * With client's -P own snake is also drawn ahead of the server, as PIXEL records of other types.
+ * Predicted pixel is either confirmed by PIXEL at the same place or retracted, after which GUI
+ * shows whatever it has from PIXEL records there. Text lines are PREDICTED_PIXEL x y name and
+ * RETRACTED_PIXEL x y name. */
+
+namespace GuiProtocol {
+
+    uint8_t const NEW_GAME = 0;
+    uint8_t const PIXEL = 1;
+    uint8_t const PLAYER_ELIMINATED = 2;
+    uint8_t const PREDICTED_PIXEL = 3;
+    uint8_t const RETRACTED_PIXEL = 4;
+
+    size_t const PIXEL_SIZE = 10;
+    size_t const PLAYER_ELIMINATED_SIZE = 2;
+}
+
+#endif //II_GUI_PROTOCOL_H
@@ -0,0 +1,161 @@
+#include <cstdint>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "handoff.h"
+
+namespace {
+
+    // longest the running game is stopped for a successor which doesn't go on with the handoff
+    int const HANDOFF_TIMEOUT_S = 2;
+    char const ACK = 1, RELEASE = 2;
+
+    void set_timeouts(int fd)
+    {
+        timeval timeout = {HANDOFF_TIMEOUT_S, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+
+    bool unix_address(std::string const &path, sockaddr_un &addr)
+    {
+        addr = {};
+        addr.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+            return false;
+        }
+        memcpy(addr.sun_path, path.data(), path.size());
+        return true;
+    }
+
+    bool write_all(int fd, char const *data, size_t len)
+    {
+        while (len > 0) {
+            ssize_t written = write(fd, data, len);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                return false;
+            }
+            data += written;
+            len -= written;
+        }
+        return true;
+    }
+
+    bool read_all(int fd, char *data, size_t len)
+    {
+        while (len > 0) {
+            ssize_t got = read(fd, data, len);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                return false;
+            }
+            data += got;
+            len -= got;
+        }
+        return true;
+    }
+}
+
+int receive_handoff(std::string const &path, std::string &snapshot, Socket &conn)
+{
+    sockaddr_un addr;
+    Socket attempt;
+    if (!unix_address(path, addr) || (attempt.fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 ||
+            connect(attempt.fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1) {
+        return -1;
+    }
+
+    // socket travels as ancillary data along with the snapshot size
+    uint64_t size;
+    iovec iov = {&size, sizeof(size)};
+    char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(attempt.fd, &msg, MSG_WAITALL) != sizeof(size)) {
+        return -1;
+    }
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+        return -1;
+    }
+    Socket sock;
+    memcpy(&sock.fd, CMSG_DATA(cmsg), sizeof(int));
+
+    snapshot.resize(size);
+    if (!read_all(attempt.fd, &snapshot[0], size)) {
+        return -1;
+    }
+    conn = std::move(attempt);
+    int fd = sock.fd;
+    sock.fd = -1;
+    return fd;
+}
+
+bool confirm_handoff(Socket &conn)
+{
+    // predecessor which gave up mustn't take the successor down with SIGPIPE, it only lets
+    // the successor go on once it got the confirmation in time
+    char release = 0;
+    set_timeouts(conn.fd);
+    bool released = send(conn.fd, &ACK, 1, MSG_NOSIGNAL) == 1 && read_all(conn.fd, &release, 1) &&
+            release == RELEASE;
+    close(conn.fd);
+    conn.fd = -1;
+    return released;
+}
+
+int listen_for_successor(std::string const &path)
+{
+    sockaddr_un addr;
+    Socket listener;
+    if (!unix_address(path, addr) || (listener.fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        return -1;
+    }
+    // path may be left by the predecessor, which doesn't accept on it anymore
+    unlink(path.c_str());
+    if (bind(listener.fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1 ||
+            listen(listener.fd, 1) == -1) {
+        return -1;
+    }
+    int fd = listener.fd;
+    listener.fd = -1;
+    return fd;
+}
+
+bool send_handoff(int listener, int sock, std::string const &snapshot)
+{
+    Socket conn;
+    if ((conn.fd = accept(listener, nullptr, nullptr)) == -1) {
+        return false;
+    }
+    set_timeouts(conn.fd);
+
+    uint64_t size = snapshot.size();
+    iovec iov = {&size, sizeof(size)};
+    char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &sock, sizeof(int));
+    if (sendmsg(conn.fd, &msg, 0) != sizeof(size) || !write_all(conn.fd, snapshot.data(), snapshot.size())) {
+        return false;
+    }
+
+    // without confirmation in time the socket is still served here, successor which confirms
+    // later isn't released and exits
+    char ack = 0;
+    return read_all(conn.fd, &ack, 1) && ack == ACK && send(conn.fd, &RELEASE, 1, MSG_NOSIGNAL) == 1;
+}
@@ -0,0 +1,25 @@
+#ifndef II_HANDOFF_H
+#define II_HANDOFF_H
+
+#include <string>
+#include "utils.h"
+
+/* Passing the game socket and state to a new server process over a Unix socket */
+
+// Asks the server listening at path for its socket and state snapshot, returns received
+// socket or -1 if no server is listening there or handoff failed. Predecessor keeps serving
+// until confirm_handoff is called on conn.
+int receive_handoff(std::string const &path, std::string &snapshot, Socket &conn);
+// true if predecessor took the confirmation and stops serving, false if it's gone or gave up
+// waiting meanwhile
+bool confirm_handoff(Socket &conn);
+
+// Unix socket at path on which a successor is awaited, -1 on error.
+int listen_for_successor(std::string const &path);
+
+// Sends socket and snapshot to the successor that connected to listener, true if the successor
+// confirmed it took over. The game is stopped meanwhile, so a successor which doesn't confirm
+// within a bounded time is given up on.
+bool send_handoff(int listener, int sock, std::string const &snapshot);
+
+#endif //II_HANDOFF_H
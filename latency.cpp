@@ -0,0 +1,67 @@
+#include <algorithm>
+#include "latency.h"
+
+LatencyStats::LatencyStats() : histogram{}, samples{0}, srtt{0}, rttvar{0} {}
+
+size_t LatencyStats::bucket(uint64_t micros)
+{
+    if (micros < SUB_BUCKETS) {
+        return micros;
+    }
+    size_t msb = 63 - __builtin_clzll(micros);
+    size_t sub = (micros >> (msb - 2)) & (SUB_BUCKETS - 1);
+    size_t b = (msb - 1) * SUB_BUCKETS + sub;
+    return (b < BUCKETS)? b : BUCKETS - 1;
+}
+
+uint64_t LatencyStats::bucket_limit(size_t bucket)
+{
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    size_t msb = bucket / SUB_BUCKETS + 1, sub = bucket % SUB_BUCKETS;
+    return ((SUB_BUCKETS + sub + 1) << (msb - 2)) - 1;
+}
+
+void LatencyStats::add(uint64_t micros)
+{
+    ++histogram[bucket(micros)];
+    if (samples++ == 0) {
+        srtt = micros;
+        rttvar = micros / 2;
+        return;
+    }
+    uint64_t deviation = (srtt > micros)? srtt - micros : micros - srtt;
+    rttvar = (3 * rttvar + deviation) / 4;
+    srtt = (7 * srtt + micros) / 8;
+}
+
+uint64_t LatencyStats::count() const
+{
+    return samples;
+}
+
+uint64_t LatencyStats::smoothed() const
+{
+    return srtt;
+}
+
+uint64_t LatencyStats::variation() const
+{
+    return rttvar;
+}
+
+uint64_t LatencyStats::percentile(double q) const
+{
+    if (samples == 0) {
+        return 0;
+    }
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * samples + 0.5)), seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        seen += histogram[i];
+        if (seen >= rank) {
+            return bucket_limit(i);
+        }
+    }
+    return bucket_limit(BUCKETS - 1);
+}
@@ -0,0 +1,31 @@
+#ifndef II_LATENCY_H
+#define II_LATENCY_H
+
+#include <cstdint>
+#include <cstddef>
+
+/* Round trip samples of a single player in microseconds, smoothed as TCP does (RFC 6298) and
+ * counted in a log scale histogram with four buckets per power of two, so that percentiles
+ * are off by at most a quarter */
+class LatencyStats {
+    static size_t const SUB_BUCKETS = 4;
+    static size_t const BUCKETS = 26 * SUB_BUCKETS; // up to 2^27 us, longer samples count as such
+
+    uint32_t histogram[BUCKETS];
+    uint64_t samples;
+    uint64_t srtt, rttvar;
+
+    static size_t bucket(uint64_t micros);
+    static uint64_t bucket_limit(size_t bucket);
+
+public:
+    LatencyStats();
+    void add(uint64_t micros);
+    uint64_t count() const;
+    uint64_t smoothed() const;
+    uint64_t variation() const;
+    // upper limit of the bucket holding q-quantile of samples, q in [0, 1], 0 without samples
+    uint64_t percentile(double q) const;
+};
+
+#endif //II_LATENCY_H
@@ -0,0 +1,187 @@
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include "movement.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+    /* Unit vectors of whole degree headings, computed exactly as by per snake cos and sin calls */
+    struct DegreeTables {
+        double cos[360], sin[360];
+        int32_t fcos[360], fsin[360];
+
+        DegreeTables()
+        {
+            for (int32_t d = 0; d < 360; ++d) {
+                cos[d] = std::cos(M_PI * d / 180.);
+                sin[d] = std::sin(M_PI * d / 180.);
+                fcos[d] = FixedPoint::cos(d);
+                fsin[d] = FixedPoint::sin(d);
+            }
+        }
+    };
+
+    DegreeTables const tables;
+
+    void advance_scalar(SnakeArrays &s, size_t from, uint32_t turning_speed, Physics physics)
+    {
+        int32_t ts = turning_speed;
+        for (size_t i = from; i < s.size(); ++i) {
+            int32_t d = (s.direction[i] + 360 + s.last_turn_direction[i] * ts) % 360;
+            s.direction[i] = d;
+            if (physics == Physics::FIXED) {
+                s.fx[i] += tables.fcos[d];
+                s.fy[i] += tables.fsin[d];
+            }
+            else {
+                s.x[i] += tables.cos[d];
+                s.y[i] += tables.sin[d];
+            }
+        }
+    }
+
+#if defined(__x86_64__)
+
+    // (d + 360 + t * ts) % 360 for t in {-1, 0, 1}, d in [0, 360) and ts in [0, 360)
+    __m128i next_direction_sse2(__m128i d, __m128i t, __m128i ts)
+    {
+        __m128i c360 = _mm_set1_epi32(360), c359 = _mm_set1_epi32(359);
+        __m128i left = _mm_srai_epi32(t, 31);
+        __m128i turn = _mm_andnot_si128(_mm_cmpeq_epi32(t, _mm_setzero_si128()), ts);
+        turn = _mm_sub_epi32(_mm_xor_si128(turn, left), left);
+        d = _mm_add_epi32(d, _mm_add_epi32(turn, c360));
+        // now d is in [1, 1078]
+        d = _mm_sub_epi32(d, _mm_and_si128(_mm_cmpgt_epi32(d, c359), c360));
+        return _mm_sub_epi32(d, _mm_and_si128(_mm_cmpgt_epi32(d, c359), c360));
+    }
+
+    // SSE2 has no gathers, so only turning and additions are vectorized
+    size_t advance_sse2(SnakeArrays &s, uint32_t turning_speed, Physics physics)
+    {
+        __m128i ts = _mm_set1_epi32(turning_speed);
+        size_t n = s.size() / 4 * 4;
+        for (size_t i = 0; i < n; i += 4) {
+            __m128i d = _mm_loadu_si128(reinterpret_cast<__m128i const *>(&s.direction[i]));
+            __m128i t = _mm_loadu_si128(reinterpret_cast<__m128i const *>(&s.last_turn_direction[i]));
+            d = next_direction_sse2(d, t, ts);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(&s.direction[i]), d);
+            int32_t const *nd = &s.direction[i];
+            for (size_t j = 0; j < 4; j += 2) {
+                if (physics == Physics::FIXED) {
+                    __m128i fx = _mm_loadu_si128(reinterpret_cast<__m128i const *>(&s.fx[i + j]));
+                    __m128i fy = _mm_loadu_si128(reinterpret_cast<__m128i const *>(&s.fy[i + j]));
+                    fx = _mm_add_epi64(fx, _mm_set_epi64x(tables.fcos[nd[j + 1]], tables.fcos[nd[j]]));
+                    fy = _mm_add_epi64(fy, _mm_set_epi64x(tables.fsin[nd[j + 1]], tables.fsin[nd[j]]));
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(&s.fx[i + j]), fx);
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(&s.fy[i + j]), fy);
+                }
+                else {
+                    __m128d x = _mm_loadu_pd(&s.x[i + j]), y = _mm_loadu_pd(&s.y[i + j]);
+                    x = _mm_add_pd(x, _mm_set_pd(tables.cos[nd[j + 1]], tables.cos[nd[j]]));
+                    y = _mm_add_pd(y, _mm_set_pd(tables.sin[nd[j + 1]], tables.sin[nd[j]]));
+                    _mm_storeu_pd(&s.x[i + j], x);
+                    _mm_storeu_pd(&s.y[i + j], y);
+                }
+            }
+        }
+        return n;
+    }
+
+    __attribute__((target("avx2")))
+    size_t advance_avx2(SnakeArrays &s, uint32_t turning_speed, Physics physics)
+    {
+        __m256i ts = _mm256_set1_epi32(turning_speed);
+        __m256i c360 = _mm256_set1_epi32(360), c359 = _mm256_set1_epi32(359);
+        size_t n = s.size() / 8 * 8;
+        for (size_t i = 0; i < n; i += 8) {
+            __m256i d = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(&s.direction[i]));
+            __m256i t = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(&s.last_turn_direction[i]));
+            d = _mm256_add_epi32(d, _mm256_add_epi32(_mm256_sign_epi32(ts, t), c360));
+            d = _mm256_sub_epi32(d, _mm256_and_si256(_mm256_cmpgt_epi32(d, c359), c360));
+            d = _mm256_sub_epi32(d, _mm256_and_si256(_mm256_cmpgt_epi32(d, c359), c360));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(&s.direction[i]), d);
+            __m128i halves[2] = {_mm256_castsi256_si128(d), _mm256_extracti128_si256(d, 1)};
+            // masked gathers with explicit zero source, every lane is loaded
+            for (size_t h = 0; h < 2; ++h) {
+                size_t k = i + 4 * h;
+                if (physics == Physics::FIXED) {
+                    __m128i zero = _mm_setzero_si128(), all = _mm_set1_epi32(-1);
+                    __m256i dx = _mm256_cvtepi32_epi64(
+                            _mm_mask_i32gather_epi32(zero, tables.fcos, halves[h], all, 4));
+                    __m256i dy = _mm256_cvtepi32_epi64(
+                            _mm_mask_i32gather_epi32(zero, tables.fsin, halves[h], all, 4));
+                    __m256i *fx = reinterpret_cast<__m256i *>(&s.fx[k]);
+                    __m256i *fy = reinterpret_cast<__m256i *>(&s.fy[k]);
+                    _mm256_storeu_si256(fx, _mm256_add_epi64(_mm256_loadu_si256(fx), dx));
+                    _mm256_storeu_si256(fy, _mm256_add_epi64(_mm256_loadu_si256(fy), dy));
+                }
+                else {
+                    __m256d zero = _mm256_setzero_pd();
+                    __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+                    __m256d dx = _mm256_mask_i32gather_pd(zero, tables.cos, halves[h], all, 8);
+                    __m256d dy = _mm256_mask_i32gather_pd(zero, tables.sin, halves[h], all, 8);
+                    _mm256_storeu_pd(&s.x[k], _mm256_add_pd(_mm256_loadu_pd(&s.x[k]), dx));
+                    _mm256_storeu_pd(&s.y[k], _mm256_add_pd(_mm256_loadu_pd(&s.y[k]), dy));
+                }
+            }
+        }
+        return n;
+    }
+
+#endif
+}
+
+size_t SnakeArrays::size() const
+{
+    return direction.size();
+}
+
+void SnakeArrays::clear()
+{
+    x.clear();
+    y.clear();
+    fx.clear();
+    fy.clear();
+    direction.clear();
+    last_turn_direction.clear();
+    px.clear();
+    py.clear();
+    eliminated.clear();
+}
+
+void SnakeArrays::push_back(uint32_t pixel_x, uint32_t pixel_y, int32_t dir, int32_t turn_direction)
+{
+    x.push_back(pixel_x + 0.5);
+    y.push_back(pixel_y + 0.5);
+    fx.push_back(FixedPoint::from_pixel(pixel_x));
+    fy.push_back(FixedPoint::from_pixel(pixel_y));
+    direction.push_back(dir);
+    last_turn_direction.push_back(turn_direction);
+    px.push_back(pixel_x);
+    py.push_back(pixel_y);
+    eliminated.push_back(false);
+}
+
+void advance_snakes(SnakeArrays &s, uint32_t turning_speed, Physics physics)
+{
+    size_t done = 0;
+#if defined(__x86_64__)
+    static bool const avx2 = __builtin_cpu_supports("avx2");
+    done = avx2? advance_avx2(s, turning_speed, physics) : advance_sse2(s, turning_speed, physics);
+#endif
+    advance_scalar(s, done, turning_speed, physics);
+}
+
+void snake_pixel(SnakeArrays const &s, size_t i, Physics physics, uint32_t &px, uint32_t &py)
+{
+    if (physics == Physics::FIXED) {
+        px = FixedPoint::to_pixel(s.fx[i]);
+        py = FixedPoint::to_pixel(s.fy[i]);
+    }
+    else {
+        px = static_cast<uint32_t>(s.x[i]);
+        py = static_cast<uint32_t>(s.y[i]);
+    }
+}
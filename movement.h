@@ -0,0 +1,33 @@
+#ifndef II_MOVEMENT_H
+#define II_MOVEMENT_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "fixed_point.h"
+
+/* Floating point movement as in original rules or its bit-reproducible fixed point version */
+enum class Physics : uint8_t { FLOATING, FIXED };
+
+/* Hot state of all snakes of a round as structure of arrays indexed by player number */
+struct SnakeArrays {
+    std::vector<double> x, y; // current position on board
+    std::vector<int64_t> fx, fy; // current position in fixed point, used by Physics::FIXED
+    std::vector<int32_t> direction; //current direction snake will move in
+    std::vector<int32_t> last_turn_direction; //last valid turn_direction:{-1,0,1} submitted by player
+    std::vector<uint32_t> px, py; //pixel snake occupied after its last registered move
+    std::vector<uint8_t> eliminated;
+
+    size_t size() const;
+    void clear();
+    void push_back(uint32_t pixel_x, uint32_t pixel_y, int32_t direction, int32_t turn_direction);
+};
+
+// Turns and moves every snake by a single step, eliminated ones included as their state
+// no longer matters. Uses AVX2 or SSE2 when available, plain loop otherwise.
+void advance_snakes(SnakeArrays &s, uint32_t turning_speed, Physics physics);
+
+// pixel snake i is in now, anything off the left or top edge maps to values beyond any board
+void snake_pixel(SnakeArrays const &s, size_t i, Physics physics, uint32_t &px, uint32_t &py);
+
+#endif //II_MOVEMENT_H
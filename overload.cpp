@@ -0,0 +1,53 @@
+#include <iostream>
+#include "overload.h"
+#include "trace.h"
+
+OverloadControl::OverloadControl() : level{NONE}, overruns{0}, calm{0}, ticks{0}, deferred{0}, capped{0} {}
+
+void OverloadControl::change(Level to)
+{
+    static char const *what[] = {"sending everything", "deferring lurkers' catch-up",
+                                 "capping datagrams per player catching up"};
+    std::cerr << "Overload: " << what[to] << " after " << ticks << " ticks, passed over lurkers "
+              << deferred << " times, capped players " << capped << " times" << std::endl;
+    Trace::record(Trace::OVERLOAD, to, deferred + capped);
+    level = to;
+    if (level == NONE) {
+        ticks = deferred = capped = 0;
+    }
+}
+
+void OverloadControl::tick(bool overrun)
+{
+    if (level != NONE) {
+        ++ticks;
+    }
+    if (overrun) {
+        calm = 0;
+        if (++overruns >= ESCALATE_AFTER && level != CAP_PLAYERS) {
+            overruns = 0;
+            change(static_cast<Level>(level + 1));
+        }
+        return;
+    }
+    overruns = 0;
+    if (++calm >= RELAX_AFTER && level != NONE) {
+        calm = 0;
+        change(static_cast<Level>(level - 1));
+    }
+}
+
+OverloadControl::Level OverloadControl::current() const
+{
+    return level;
+}
+
+void OverloadControl::shed_lurker()
+{
+    ++deferred;
+}
+
+void OverloadControl::shed_capped()
+{
+    ++capped;
+}
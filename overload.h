@@ -0,0 +1,41 @@
+#ifndef II_OVERLOAD_H
+#define II_OVERLOAD_H
+
+#include <cstdint>
+#include <cstddef>
+
+/* Decides how much sending to shed from whether the send work queued for a tick got done
+ * before the next one. Ticks themselves and caught up players are never held back: first
+ * lurkers' catch-up is deferred, then every player catching up gets at most a few datagrams
+ * per tick. */
+class OverloadControl {
+public:
+    enum Level {
+        NONE,
+        DEFER_LURKERS,
+        CAP_PLAYERS
+    };
+
+private:
+    Level level;
+    uint32_t overruns, calm; // consecutive ticks
+    uint64_t ticks; // since shedding started
+    uint64_t deferred, capped; // players passed over since shedding started, once per tick each
+
+    void change(Level to);
+
+public:
+    static uint32_t const ESCALATE_AFTER = 3; // overrun ticks
+    static uint32_t const RELAX_AFTER = 50; // calm ticks
+    static uint32_t const PLAYER_CAP = 4; // datagrams per player catching up per tick when capping
+
+    OverloadControl();
+
+    // called when a tick is due, overrun if sending queue wasn't done since the previous one
+    void tick(bool overrun);
+    Level current() const;
+    void shed_lurker();
+    void shed_capped();
+};
+
+#endif //II_OVERLOAD_H
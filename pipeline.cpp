@@ -0,0 +1,215 @@
+#include <atomic>
+#include <cerrno>
+#include <ctime>
+#include <iostream>
+#include <thread>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "pipeline.h"
+#include "spsc_queue.h"
+#include "trace.h"
+
+namespace {
+
+    size_t const QUEUE_CAPACITY = 1024; // power of two
+    size_t const MAX_RECV_BURST = 64; // datagrams read before the sending side gets its turn
+
+    /* Parsed client event on its way to the simulation thread */
+    struct Command {
+        Event::ClientEvent event;
+        sockaddr_storage addr;
+        uint64_t rec_time;
+    };
+
+    /* Datagram prepared by the simulation thread */
+    struct Outgoing {
+        std::string buffer;
+        sockaddr_storage addr;
+    };
+
+    struct Shared {
+        SpscQueue<Command> commands;
+        SpscQueue<Outgoing> datagrams;
+        std::atomic<bool> stop;
+        int sim_wakeup, io_wakeup; // eventfds
+
+        Shared() : commands(QUEUE_CAPACITY), datagrams(QUEUE_CAPACITY), stop{false},
+                   sim_wakeup{eventfd(0, EFD_NONBLOCK)}, io_wakeup{eventfd(0, EFD_NONBLOCK)} {}
+
+        ~Shared()
+        {
+            close(sim_wakeup);
+            close(io_wakeup);
+        }
+    };
+
+    uint64_t now()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * NANOSPERS + ts.tv_nsec;
+    }
+
+    void wake(int fd)
+    {
+        uint64_t one = 1;
+        if (write(fd, &one, sizeof(one)) < 0) {
+            // counter is already non zero, the other side is going to wake up anyway
+        }
+    }
+
+    void clear_wakeups(int fd)
+    {
+        uint64_t cnt;
+        if (read(fd, &cnt, sizeof(cnt)) < 0) {
+            // nothing to clear
+        }
+    }
+
+    void simulate(Shared &sh, GameState &gs, uint64_t tick)
+    {
+        pollfd wakeup = {sh.sim_wakeup, POLLIN, 0};
+        bool timer_active = false;
+        uint64_t deadline = 0;
+        Command command;
+        Outgoing datagram;
+        while (!sh.stop.load()) {
+            timespec timeout, *tp = nullptr;
+            if (timer_active) {
+                uint64_t current = now(), left = deadline > current? deadline - current : 0;
+                timeout.tv_sec = left / NANOSPERS;
+                timeout.tv_nsec = left % NANOSPERS;
+                tp = &timeout;
+            }
+            if (ppoll(&wakeup, 1, tp, nullptr) > 0) {
+                clear_wakeups(sh.sim_wakeup);
+            }
+            // tick goes first, whatever is waiting in the queues
+            if (timer_active && now() >= deadline) {
+                gs.cycle();
+                timer_active = std::get<1>(gs.has_active_round());
+                uint64_t current = now();
+                deadline += tick;
+                // skip ticks missed meanwhile
+                if (deadline <= current) {
+                    deadline += (current - deadline) / tick * tick + tick;
+                }
+            }
+            while (sh.commands.pop(command)) {
+                gs.got_event(command.event, command.addr, command.rec_time);
+            }
+            // if new round started as a consequence of player's move
+            if (std::get<1>(gs.has_active_round()) && !timer_active) {
+                timer_active = true;
+                deadline = now() + tick;
+            }
+            bool produced = false;
+            while (gs.want_to_write() && !sh.datagrams.full()) {
+                if (timer_active && now() >= deadline) {
+                    break;
+                }
+                if (gs.next_datagram(datagram.buffer, datagram.addr)) {
+                    sh.datagrams.push(datagram);
+                    // datagram lost to a full socket buffer is requested again by the client
+                    gs.mark_sent();
+                    produced = true;
+                }
+            }
+            if (produced) {
+                wake(sh.io_wakeup);
+            }
+        }
+    }
+
+    // reads available datagrams, true if any event was passed on
+    bool receive(int sock, Shared &sh)
+    {
+        char datagram[MAX_FROM_CLIENT_DATAGRAM_SIZE + 1];
+        bool passed = false;
+        Command command;
+        for (size_t i = 0; i < MAX_RECV_BURST; ++i) {
+            socklen_t addr_len = sizeof(command.addr);
+            ssize_t len = recvfrom(sock, datagram, sizeof(datagram), 0,
+                                   reinterpret_cast<sockaddr *>(&command.addr), &addr_len);
+            if (len < 0) {
+                break;
+            }
+            command.rec_time = milliseconds_since_epoch();
+            // simply ignore incorrect messages
+            if (len == 0 || len > static_cast<ssize_t>(MAX_FROM_CLIENT_DATAGRAM_SIZE)) {
+                continue;
+            }
+            if (!command.event.parse(std::string(datagram, len))) {
+                std::cerr << "Dropping incorrect message" << std::endl;
+                continue;
+            }
+            // events over capacity are lost like any datagram
+            passed |= sh.commands.push(command);
+        }
+        return passed;
+    }
+}
+
+void run_pipeline(int sock, GameState &gs, uint64_t tick_nanos, bool const &finish)
+{
+    Shared sh;
+    if (sh.sim_wakeup < 0 || sh.io_wakeup < 0) {
+        std::cerr << last_err("Eventfd: ") << std::endl;
+        return;
+    }
+
+    // interrupts are left to this thread
+    sigset_t blocked, previous;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+    std::thread simulation(simulate, std::ref(sh), std::ref(gs), tick_nanos);
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+
+    pollfd fds[2] = {{sock, POLLIN, 0}, {sh.io_wakeup, POLLIN, 0}};
+    Outgoing datagram;
+    bool unsent = false;
+    while (!finish) {
+        fds[0].events = unsent? (POLLIN | POLLOUT) : POLLIN;
+        fds[0].revents = fds[1].revents = 0;
+        if (poll(fds, 2, -1) <= 0) {
+            continue;
+        }
+        if (fds[1].revents & POLLIN) {
+            clear_wakeups(sh.io_wakeup);
+        }
+        if ((fds[0].revents & POLLIN) && receive(sock, sh)) {
+            wake(sh.sim_wakeup);
+        }
+        bool popped = false;
+        while (true) {
+            if (!unsent) {
+                if (!sh.datagrams.pop(datagram)) {
+                    break;
+                }
+                unsent = popped = true;
+            }
+            auto len = sendto(sock, &datagram.buffer[0], datagram.buffer.size(), 0,
+                              reinterpret_cast<sockaddr *>(&datagram.addr), sizeof(datagram.addr));
+            if (len < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) {
+                Trace::record(Trace::WOULD_BLOCK, datagram.buffer.size(), 1);
+                break;
+            }
+            if (len >= 0) {
+                Trace::record(Trace::SENT, len, 1);
+            }
+            unsent = false;
+        }
+        // simulation thread may wait for space to prepare more, queue might have filled up
+        // only after it was checked here, so any freed space is reported
+        if (popped) {
+            wake(sh.sim_wakeup);
+        }
+    }
+
+    sh.stop.store(true);
+    wake(sh.sim_wakeup);
+    simulation.join();
+}
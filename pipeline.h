@@ -0,0 +1,12 @@
+#ifndef II_PIPELINE_H
+#define II_PIPELINE_H
+
+#include <cstdint>
+#include "game_state.h"
+
+// Serves the game over sock until finish is set with two threads: the calling one receives,
+// parses and sends datagrams while a simulation thread owns gs, applies client events, runs
+// cycles on time and prepares datagrams. They exchange data over lock-free queues only.
+void run_pipeline(int sock, GameState &gs, uint64_t tick_nanos, bool const &finish);
+
+#endif //II_PIPELINE_H
@@ -0,0 +1,389 @@
+#include <cstdint>
+#include <ctime>
+#include <iostream>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+#include <poll.h>
+#include "utils.h"
+#include "events.h"
+
+/* Relay connects to game server as a single spectating client, mirrors history of the current
+ * round and serves it to any number of clients in the same protocol */
+
+namespace {
+
+    uint64_t const UPSTREAM_HEARTBEAT_MS = 20;
+    // beyond it datagrams from new addresses are ignored until some spectator is disconnected
+    size_t const MAX_SPECTATORS = 4096;
+
+    /* Client connected to the relay, it can only watch */
+    struct Spectator {
+        sockaddr_storage addr;
+        uint64_t session_id;
+        uint32_t expected_no;
+        uint64_t last_contact;
+    };
+
+    // port and address only, so that equal addresses give equal keys
+    std::string address_key(sockaddr_storage const &addr)
+    {
+        if (addr.ss_family == AF_INET) {
+            auto *in = reinterpret_cast<sockaddr_in const *>(&addr);
+            return std::string(reinterpret_cast<char const *>(&in->sin_port), sizeof(in->sin_port)) +
+                   std::string(reinterpret_cast<char const *>(&in->sin_addr), sizeof(in->sin_addr));
+        }
+        auto *in6 = reinterpret_cast<sockaddr_in6 const *>(&addr);
+        return std::string(reinterpret_cast<char const *>(&in6->sin6_port), sizeof(in6->sin6_port)) +
+               std::string(reinterpret_cast<char const *>(&in6->sin6_addr), sizeof(in6->sin6_addr));
+    }
+
+    class Relay {
+        /* Mirror of the upstream round */
+        bool has_round, round_over;
+        uint32_t game_id;
+        Event::History history;
+
+        /* Downstream */
+        std::unordered_map<std::string, Spectator> spectators;
+        std::queue<std::string> pending_queue;
+        std::unordered_set<std::string> pending;
+        bool head_in_progress;
+        size_t head_expected_no, head_next_no;
+
+        void notify(std::string const &key)
+        {
+            if (pending.insert(key).second) {
+                pending_queue.push(key);
+            }
+        }
+
+        void pop_head()
+        {
+            head_in_progress = false;
+            pending.erase(pending_queue.front());
+            pending_queue.pop();
+        }
+
+        void disconnect_inactive(uint64_t now)
+        {
+            for (auto it = spectators.begin(); it != spectators.end();) {
+                if (now - it->second.last_contact >= INACTIVITY_TOLERANCE) {
+                    it = spectators.erase(it);
+                }
+                else {
+                    ++it;
+                }
+            }
+        }
+
+    public:
+        Relay() : has_round{false}, round_over{false}, game_id{0}, head_in_progress{false},
+                  head_expected_no{0}, head_next_no{0} {}
+
+        // what relay asks the server for, after game over a new round is awaited from its start
+        uint32_t upstream_expected_no()
+        {
+            return round_over? 0 : history.size();
+        }
+
+        void got_upstream(std::string const &datagram)
+        {
+            if (datagram.size() < 4) {
+                return;
+            }
+            uint32_t r_game_id = Event::parse<uint32_t>(&datagram[0]);
+            bool fresh = !has_round || (round_over && r_game_id != game_id);
+            if (!fresh && r_game_id != game_id) {
+                return;
+            }
+            bool appended = false;
+            size_t it = 4, len;
+            while ((len = Event::verify_message(datagram, it)) > 0) {
+                uint32_t event_no = Event::parse<uint32_t>(&datagram[it + 4]);
+                char type = datagram[it + 8];
+                if (fresh && event_no == 0 && type == 0) {
+                    // new round starts replacing the finished one
+                    history.clear();
+                    game_id = r_game_id;
+                    has_round = true;
+                    round_over = false;
+                    fresh = false;
+                }
+                if (!fresh && !round_over && event_no == history.size()) {
+                    history.append_framed(&datagram[it], len + 8);
+                    round_over = type == 3;
+                    appended = true;
+                }
+                it += len + 8;
+            }
+            if (appended) {
+                for (auto &s : spectators) {
+                    notify(s.first);
+                }
+            }
+        }
+
+        void got_downstream(std::string const &buffer, sockaddr_storage const &addr, uint64_t rec_time)
+        {
+            Event::ClientEvent e;
+            if (!e.parse(buffer)) {
+                std::cerr << "Dropping incorrect message" << std::endl;
+                return;
+            }
+            disconnect_inactive(rec_time);
+            std::string key = address_key(addr);
+            auto it = spectators.find(key);
+            if (it != spectators.end() && e.session_id < it->second.session_id) {
+                return;
+            }
+            if (it == spectators.end() && spectators.size() >= MAX_SPECTATORS) {
+                return;
+            }
+            Spectator &s = spectators[key];
+            s.addr = addr;
+            s.session_id = e.session_id;
+            s.expected_no = e.next_expected_event_no;
+            s.last_contact = rec_time;
+            notify(key);
+        }
+
+        bool want_to_write()
+        {
+            return !pending_queue.empty();
+        }
+
+        // same packing as the game server: as many events from expected on as fit in a datagram
+        bool next_datagram(std::string &buffer, sockaddr_storage &addr)
+        {
+            while (!pending_queue.empty()) {
+                auto it = spectators.find(pending_queue.front());
+                if (it == spectators.end() || !has_round) {
+                    pop_head();
+                    continue;
+                }
+                if (!head_in_progress) {
+                    head_in_progress = true;
+                    head_expected_no = it->second.expected_no;
+                }
+                if (head_expected_no >= history.size()) {
+                    pop_head();
+                    continue;
+                }
+                buffer = Event::serialize(game_id);
+                size_t budget = MAX_FROM_SERVER_DATAGRAM_SIZE - 4, packed = 0;
+                for (head_next_no = head_expected_no; head_next_no < history.size(); ++head_next_no) {
+                    size_t begin = history.begin(head_next_no);
+                    size_t size = history.positions[head_next_no] - begin;
+                    if (packed > 0 && packed + size > budget) {
+                        break;
+                    }
+                    buffer.insert(buffer.size(), &history.events[begin], size);
+                    packed += size;
+                }
+                addr = it->second.addr;
+                return true;
+            }
+            return false;
+        }
+
+        void mark_sent()
+        {
+            head_expected_no = head_next_no;
+            if (head_expected_no >= history.size()) {
+                pop_head();
+            }
+        }
+    };
+}
+
+int main(int argc, char *argv[])
+{
+
+    /* Parsing arguments */
+    uint32_t port = 12345;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:")) != -1) {
+        if (opt != 'p' || optarg == NULL) {
+            std::cerr << "Usage " << argv[0] << " [-p n] game_server_host[:port]" << std::endl;
+            return 1;
+        }
+        try {
+            port = str2uint32_t(optarg);
+        } catch (UtilsError const &e) {
+            std::cerr << "p: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    if (optind + 1 != argc) {
+        std::cerr << "Usage " << argv[0] << " [-p n] game_server_host[:port]" << std::endl;
+        return 1;
+    }
+
+    std::string sa = argv[optind], sp = "12345";
+    if (!sa.length() || sa.back() == ':') {
+        std::cerr << "Incorrect game server address" << std::endl;
+        return 1;
+    }
+    auto pos = sa.rfind(':');
+    if (pos != std::string::npos) {
+        sp = sa.substr(pos + 1);
+        sa.resize(pos);
+    }
+
+    try {
+        if (!is_valid_port(port) || !is_valid_port(str2uint32_t(sp))) {
+            std::cerr << "Incorrect port number" << std::endl;
+            return 1;
+        }
+    }
+    catch (UtilsError &e) {
+        std::cerr << "Port parsing: " << e.what() << std::endl;
+        return 1;
+    }
+
+    /* Upstream socket */
+    Socket usock;
+    {
+        struct addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+
+        AddrInfo info(&sa[0], &sp[0], hints);
+        if (!info.info) {
+            std::cerr << "getaddrinfo: " << info.err << std::endl;
+            return 1;
+        }
+
+        std::string last_error;
+        for (addrinfo *p = info.info; p != NULL && usock.fd == -1; p = p->ai_next) {
+            Socket try_socket;
+            if ((try_socket.fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1) {
+                last_error = last_err("Socket: ");
+                continue;
+            }
+            if (connect(try_socket.fd, p->ai_addr, p->ai_addrlen) == -1) {
+                last_error = last_err("Connect: ");
+                continue;
+            }
+            usock = std::move(try_socket);
+        }
+
+        if (usock.fd == -1) {
+            std::cerr << "Couldn't create upstream socket. " << last_error << std::endl;
+            return 1;
+        }
+    }
+
+    /* Downstream socket, first try IPv6 then IPv4 as the game server does */
+    Socket dsock;
+    {
+        struct addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        hints.ai_flags = AI_PASSIVE;
+
+        AddrInfo info(nullptr, std::to_string(port).c_str(), hints);
+        if (!info.info) {
+            std::cerr << "getaddrinfo: " << info.err << std::endl;
+            return 1;
+        }
+
+        std::string last_error;
+        for (auto flag: {AF_INET6, AF_INET}) {
+            for (addrinfo *p = info.info; p != NULL && dsock.fd == -1; p = p->ai_next) {
+                if ((p->ai_family & flag) != flag) {
+                    continue;
+                }
+                Socket try_socket;
+                if ((try_socket.fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1) {
+                    last_error = last_err("Socket: ");
+                    continue;
+                }
+                if (bind(try_socket.fd, p->ai_addr, p->ai_addrlen) == -1) {
+                    last_error = last_err("Bind: ");
+                    continue;
+                }
+                dsock = std::move(try_socket);
+            }
+        }
+
+        if (dsock.fd == -1) {
+            std::cerr << "Couldn't create socket. " << last_error << std::endl;
+            return 1;
+        }
+    }
+
+    if (fcntl(usock.fd, F_SETFL, O_NONBLOCK) < 0 || fcntl(dsock.fd, F_SETFL, O_NONBLOCK) < 0) {
+        std::cerr << last_err("Fcntl: ") << std::endl;
+        return 1;
+    }
+
+    /* Session id is microseconds elapsed since epoch as in the client */
+    Event::ClientEvent heartbeat;
+    {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        heartbeat.session_id = UINT64_C(1000000) * (tv.tv_sec) + (tv.tv_usec);
+    }
+    heartbeat.turn_direction = 0;
+
+    /* Actual communication kicks off */
+    Relay relay;
+    pollfd fds[2] = {{usock.fd, POLLIN, 0}, {dsock.fd, POLLIN, 0}};
+    uint64_t next_heartbeat = 0;
+    std::string buffer;
+
+    while (true) {
+        uint64_t now = milliseconds_since_epoch();
+        if (now >= next_heartbeat) {
+            heartbeat.next_expected_event_no = relay.upstream_expected_no();
+            std::string message = heartbeat.serialize();
+            // refused while the server is down, relay keeps trying
+            if (send(usock.fd, &message[0], message.size(), 0) < 0 && errno != EAGAIN &&
+                    errno != ECONNREFUSED) {
+                std::cerr << last_err("Send: ") << std::endl;
+            }
+            next_heartbeat = now + UPSTREAM_HEARTBEAT_MS;
+        }
+
+        fds[1].events = relay.want_to_write()? (POLLIN | POLLOUT) : POLLIN;
+        fds[0].revents = fds[1].revents = 0;
+        if (poll(fds, 2, static_cast<int>(next_heartbeat - now)) <= 0) {
+            continue;
+        }
+        if (fds[0].revents & POLLIN) {
+            buffer.resize(MAX_FROM_SERVER_DATAGRAM_SIZE + 1);
+            ssize_t len = recv(usock.fd, &buffer[0], buffer.size(), 0);
+            if (len > 0 && static_cast<size_t>(len) <= MAX_FROM_SERVER_DATAGRAM_SIZE) {
+                buffer.resize(len);
+                relay.got_upstream(buffer);
+            }
+        }
+        if (fds[1].revents & POLLIN) {
+            sockaddr_storage addr;
+            socklen_t addr_len = sizeof(addr);
+            buffer.resize(MAX_FROM_CLIENT_DATAGRAM_SIZE + 1);
+            ssize_t len = recvfrom(dsock.fd, &buffer[0], buffer.size(), 0,
+                                   reinterpret_cast<sockaddr *>(&addr), &addr_len);
+            // simply ignore incorrect messages or errors
+            if (len > 0 && static_cast<size_t>(len) <= MAX_FROM_CLIENT_DATAGRAM_SIZE) {
+                buffer.resize(len);
+                relay.got_downstream(buffer, addr, milliseconds_since_epoch());
+            }
+        }
+        if (relay.want_to_write()) {
+            sockaddr_storage addr;
+            if (relay.next_datagram(buffer, addr)) {
+                auto len = sendto(dsock.fd, &buffer[0], buffer.size(), 0,
+                                  reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+                if (len >= 0 || (errno != EWOULDBLOCK && errno != EAGAIN)) {
+                    relay.mark_sent();
+                }
+            }
+        }
+    }
+
+    return 0;
+}
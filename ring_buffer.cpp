@@ -0,0 +1,80 @@
+#include <cstring>
+#include <algorithm>
+#include "ring_buffer.h"
+
+RingBuffer::RingBuffer(size_t capacity) : buf(capacity), head{0}, len{0} {}
+
+size_t RingBuffer::size() const
+{
+    return len;
+}
+
+size_t RingBuffer::space() const
+{
+    return buf.size() - len;
+}
+
+bool RingBuffer::empty() const
+{
+    return len == 0;
+}
+
+void RingBuffer::clear()
+{
+    head = 0;
+    len = 0;
+}
+
+bool RingBuffer::push(char const *data, size_t n)
+{
+    if (n > space()) {
+        return false;
+    }
+    size_t tail = (head + len) % buf.size();
+    size_t first = std::min(n, buf.size() - tail);
+    memcpy(&buf[tail], data, first);
+    memcpy(&buf[0], data + first, n - first);
+    len += n;
+    return true;
+}
+
+int RingBuffer::pending(iovec iov[2]) const
+{
+    if (len == 0) {
+        return 0;
+    }
+    size_t first = std::min(len, buf.size() - head);
+    iov[0].iov_base = const_cast<char *>(&buf[head]);
+    iov[0].iov_len = first;
+    if (first == len) {
+        return 1;
+    }
+    iov[1].iov_base = const_cast<char *>(&buf[0]);
+    iov[1].iov_len = len - first;
+    return 2;
+}
+
+void RingBuffer::consume(size_t n)
+{
+    n = std::min(n, len);
+    head = (head + n) % buf.size();
+    len -= n;
+    // keep pending data contiguous for as long as possible
+    if (len == 0) {
+        head = 0;
+    }
+}
+
+ssize_t RingBuffer::write_to(int fd)
+{
+    iovec iov[2];
+    int cnt = pending(iov);
+    if (cnt == 0) {
+        return 0;
+    }
+    ssize_t written = writev(fd, iov, cnt);
+    if (written > 0) {
+        consume(written);
+    }
+    return written;
+}
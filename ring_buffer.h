@@ -0,0 +1,32 @@
+#ifndef II_RING_BUFFER_H
+#define II_RING_BUFFER_H
+
+#include <vector>
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* Fixed capacity byte queue, storage is allocated once and never grows */
+class RingBuffer {
+    std::vector<char> buf;
+    size_t head; // first byte not yet consumed
+    size_t len; // number of bytes not yet consumed
+
+public:
+    RingBuffer(size_t capacity);
+
+    size_t size() const;
+    size_t space() const;
+    bool empty() const;
+    void clear();
+
+    // either stores all n bytes or nothing when there is not enough space
+    bool push(char const *data, size_t n);
+    // fills at most two iovecs covering pending data, returns number of iovecs used
+    int pending(iovec iov[2]) const;
+    void consume(size_t n);
+    // writes as much pending data as fd accepts (one writev across the wrap point)
+    ssize_t write_to(int fd);
+};
+
+#endif //II_RING_BUFFER_H
@@ -5,8 +5,14 @@
 #include "utils.h"
 #include "events.h"
 #include "game_state.h"
+#include "uring_server.h"
+#include "pipeline.h"
+#include "handoff.h"
+#include "gso.h"
+#include "trace.h"
+#include "spectator_stream.h"
 
-bool finish = false, clock_interrupt = false;
+bool finish = false, clock_interrupt = false, report_requested = false;
 timer_t registered_clock;
 itimerspec clock_interval;
 
@@ -15,6 +21,11 @@ void catch_int (int sig)
     finish = true;
 }
 
+void request_report(int sig)
+{
+    report_requested = true;
+}
+
 void timer_handler(int sig, siginfo_t *si, void *uc)
 {
     if (registered_clock == *static_cast<timer_t *>(si->si_value.sival_ptr)) {
@@ -27,11 +38,34 @@ int main(int argc, char *argv[])
 
     /* Parsing arguments */
     uint32_t width = 800, height = 600,
-            port = 12345, gspeed = 50, tspeed = 6,
+            port = 12345, gspeed = 50, tspeed = 6, flush_ms = 0, spectator_port = 0,
             seed = static_cast<uint32_t >(time(NULL) % Generator::MOD);
+    Physics physics = Physics::FLOATING;
+    bool use_uring = false, use_threads = false, stream_to_spectators = false;
+    std::string handoff_path, trace_path;
     int opt;
-    while ((opt = getopt(argc, argv, "W:H:p:s:t:r:")) != -1) {
+    while ((opt = getopt(argc, argv, "W:H:p:s:t:r:F:w:fuTh:d:")) != -1) {
         uint32_t parsed;
+        if (opt == 'h' && optarg != NULL) {
+            handoff_path = optarg;
+            continue;
+        }
+        if (opt == 'd' && optarg != NULL) {
+            trace_path = optarg;
+            continue;
+        }
+        if (opt == 'f') {
+            physics = Physics::FIXED;
+            continue;
+        }
+        if (opt == 'u') {
+            use_uring = true;
+            continue;
+        }
+        if (opt == 'T') {
+            use_threads = true;
+            continue;
+        }
         if (optarg == NULL) {
             return 1;
         }
@@ -60,16 +94,25 @@ int main(int argc, char *argv[])
             case 'r':
                 seed = parsed;
                 break;
+            case 'F':
+                flush_ms = parsed;
+                break;
+            case 'w':
+                spectator_port = parsed;
+                stream_to_spectators = true;
+                break;
             default:
                 std::cerr << "Usage " << argv[0]
-                          << " [-W n] [-H n] [-p n] [-s n] [-t n] [-r n]" << std::endl;
+                          << " [-W n] [-H n] [-p n] [-s n] [-t n] [-r n] [-F ms] [-f] [-u | -T] [-h path]"
+                          << " [-d trace_path] [-w spectator_port]" << std::endl;
                 return 1;
         }
     }
 
     /* Purpose specific validation of arguments */
 
-    if (!is_valid_port(port)) {
+    // port 0 would listen somewhere no spectator knows of
+    if (!is_valid_port(port) || !is_valid_port(spectator_port) || (stream_to_spectators && spectator_port == 0)) {
         std::cerr << "Incorrect port number" << std::endl;
         return 1;
     }
@@ -84,47 +127,75 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    /* Connections */
-    struct addrinfo hints = {};
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_DGRAM;
-    hints.ai_flags = AI_PASSIVE;
+    if (flush_ms > 1000) {
+        std::cerr << "Flush interval should be at most 1000 ms" << std::endl;
+        return 1;
+    }
 
-    Socket sock;
-    AddrInfo info(nullptr, std::to_string(port).c_str(), hints);
+    if (use_uring && use_threads) {
+        std::cerr << "Choose either io_uring or threaded server loop" << std::endl;
+        return 1;
+    }
 
-    if (!info.info) {
-        std::cerr << "getaddrinfo: " << info.err << std::endl;
+    if (handoff_path.length() && (use_uring || use_threads)) {
+        std::cerr << "Handoff is supported by poll server loop only" << std::endl;
         return 1;
     }
 
-    // first try to create IPv6 socket, then try to create IPv6 or IPv4 socket
-    std::string last_error;
-    for (auto flag: {AF_INET6, AF_INET}) {
-        for (addrinfo *p = info.info; p != NULL && sock.fd == -1; p = p->ai_next) {
-            if ((p->ai_family & flag) != flag) {
-                continue;
-            }
+    if (stream_to_spectators && (use_uring || use_threads)) {
+        std::cerr << "Spectator stream is supported by poll server loop only" << std::endl;
+        return 1;
+    }
+
+    /* Taking over socket and state from the server listening at handoff path, if any */
+    Socket sock, predecessor;
+    std::string snapshot;
+    if (handoff_path.length()) {
+        sock.fd = receive_handoff(handoff_path, snapshot, predecessor);
+    }
+
+    /* Connections */
+    if (sock.fd == -1) {
+        struct addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        hints.ai_flags = AI_PASSIVE;
 
-            Socket try_socket;
-            if ((try_socket.fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1) {
-                last_error = last_err("Socket: ");
-                continue;
+        AddrInfo info(nullptr, std::to_string(port).c_str(), hints);
+
+        if (!info.info) {
+            std::cerr << "getaddrinfo: " << info.err << std::endl;
+            return 1;
+        }
+
+        // first try to create IPv6 socket, then try to create IPv6 or IPv4 socket
+        std::string last_error;
+        for (auto flag: {AF_INET6, AF_INET}) {
+            for (addrinfo *p = info.info; p != NULL && sock.fd == -1; p = p->ai_next) {
+                if ((p->ai_family & flag) != flag) {
+                    continue;
+                }
+
+                Socket try_socket;
+                if ((try_socket.fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1) {
+                    last_error = last_err("Socket: ");
+                    continue;
+                }
+                if (bind(try_socket.fd, p->ai_addr, p->ai_addrlen) == -1) {
+                    last_error = last_err("Bind: ");
+                    continue;
+                }
+                sock = std::move(try_socket);
             }
-            if (bind(try_socket.fd, p->ai_addr, p->ai_addrlen) == -1) {
-                last_error = last_err("Bind: ");
-                continue;
+            if (sock.fd != -1) {
+                break;
             }
-            sock = std::move(try_socket);
         }
-        if (sock.fd != -1) {
-            break;
-        }
-    }
 
-    if (sock.fd == -1) {
-        std::cerr << "Couldn't create socket. " << last_error << std::endl;
-        return 1;
+        if (sock.fd == -1) {
+            std::cerr << "Couldn't create socket. " << last_error << std::endl;
+            return 1;
+        }
     }
 
     if (fcntl(sock.fd, F_SETFL, O_NONBLOCK) < 0) {
@@ -133,13 +204,58 @@ int main(int argc, char *argv[])
     }
 
     /* Adjust signal handling */
-    if (signal(SIGINT, catch_int) == SIG_ERR) {
+    if (signal(SIGINT, catch_int) == SIG_ERR || signal(SIGUSR1, request_report) == SIG_ERR) {
         std::cerr << "Couldn't change signal handling" << std::endl;
     }
+    if (trace_path.length() && !Trace::dump_on_signals(trace_path.c_str())) {
+        std::cerr << "Couldn't set up trace dump" << std::endl;
+    }
+
+    GameState gs{seed, gspeed, tspeed, width, height, physics, flush_ms};
+    uint64_t timeout = NANOSPERS / gspeed;
+
+    if (predecessor.fd != -1) {
+        if (!gs.restore(snapshot)) {
+            std::cerr << "Couldn't restore game state (round in progress needs the same -s and -F), "
+                      << "previous server keeps running" << std::endl;
+            return 1;
+        }
+        if (!confirm_handoff(predecessor)) {
+            std::cerr << "Couldn't confirm taking over, previous server keeps running" << std::endl;
+            return 1;
+        }
+    }
+
+    Socket successor;
+    if (handoff_path.length() && (successor.fd = listen_for_successor(handoff_path)) == -1) {
+        std::cerr << last_err("Handoff socket: ") << std::endl;
+    }
+
+    SpectatorStream spectators;
+    if (stream_to_spectators) {
+        if (!spectators.listen(spectator_port)) {
+            std::cerr << last_err("Spectator socket: ") << std::endl;
+            return 1;
+        }
+        gs.on_round_replaced([&spectators](Event::History const &history, uint32_t game_id) {
+            spectators.round_replaced(history, game_id);
+        });
+    }
+
+    if (use_threads) {
+        run_pipeline(sock.fd, gs, timeout, finish);
+        return 0;
+    }
+
+    if (use_uring) {
+        if (run_uring_loop(sock.fd, gs, timeout, finish)) {
+            return 0;
+        }
+        std::cerr << "Falling back to poll" << std::endl;
+    }
 
     bool timer_active = false;
     /* Prepare timer */
-    uint64_t timeout = NANOSPERS / gspeed;
     try {
         create_timer(registered_clock, timeout, timer_handler);
         disarm_timer(registered_clock, clock_interval);
@@ -149,26 +265,47 @@ int main(int argc, char *argv[])
         std::cerr << e.what();
         return 1;
     }
+    // round taken over keeps ticking right away
+    if (std::get<1>(gs.has_active_round())) {
+        timer_active = true;
+        resume_timer(registered_clock, clock_interval);
+    }
 
-    /* Actual communication kicks off */
-    pollfd pollsocket;
-    pollsocket.fd = sock.fd;
+    /* Actual communication kicks off, spectators follow the game socket and handoff listener */
+    std::vector<pollfd> fds(2);
+    fds[0].fd = sock.fd;
+    fds[1].fd = successor.fd;
+    fds[1].events = POLLIN;
 
     sockaddr_storage client_addr;
     socklen_t addr_len = sizeof(client_addr);
 
-    GameState gs{seed, gspeed, tspeed, width, height};
     bool want_to_write = false;
+    bool gso = gso_supported(sock.fd);
     size_t max_datagram_size = MAX_FROM_CLIENT_DATAGRAM_SIZE + 1;
 
     while (!finish) {
-        pollsocket.events = (!want_to_write)? POLLIN : (POLLIN | POLLOUT);
-        pollsocket.revents = 0;
-        int ret = poll(&pollsocket, 1, -1);
+        fds[0].events = (!want_to_write)? POLLIN : (POLLIN | POLLOUT);
+        fds[0].revents = fds[1].revents = 0;
+        fds.resize(2);
+        spectators.add_to_poll(fds);
+        int ret = poll(fds.data(), fds.size(), -1);
+        if (report_requested) {
+            report_requested = false;
+            gs.report_latency(std::cerr);
+            if (stream_to_spectators) {
+                std::cerr << "spectators " << spectators.count() << std::endl;
+            }
+        }
         if (ret <= 0 && !clock_interrupt) {
             continue;
         }
-        if (pollsocket.revents & POLLIN) {
+        // state is consistent between cycles, successor goes on from here
+        if ((fds[1].revents & POLLIN) && send_handoff(successor.fd, sock.fd, gs.snapshot())) {
+            std::cerr << "Handed over to the new server" << std::endl;
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
             uint64_t rec_time = milliseconds_since_epoch();
             std::string buffer(max_datagram_size, '\0');
             size_t len = recvfrom(
@@ -197,21 +334,36 @@ int main(int argc, char *argv[])
         if (gs.want_to_write()) {
             std::string buffer;
             sockaddr_storage rec_addr;
-            auto events_no = gs.next_datagram(buffer, rec_addr);
-            if (events_no > 0) {
+            size_t segment;
+            if (gs.next_burst(buffer, rec_addr, gso? MAX_GSO_SEGMENTS : 1, segment)) {
                 /*std::cerr << "SO it begins " << events_no << ": ";
                 for (auto &c : buffer) {
                     std::cerr << (uint32_t)((uint8_t)c) << " ";
                 }
                 std::cerr << std::endl;*/
-                auto len = sendto(sock.fd, &buffer[0], buffer.size(), 0,
-                        reinterpret_cast<sockaddr *>(&rec_addr), sizeof(rec_addr));
-                if (len >= 0 || (errno != EWOULDBLOCK && errno != EAGAIN)) {
-                    gs.mark_sent(events_no);
+                auto len = (segment > 0)? send_segmented(sock.fd, buffer, segment, rec_addr) :
+                           sendto(sock.fd, &buffer[0], buffer.size(), 0,
+                                  reinterpret_cast<sockaddr *>(&rec_addr), sizeof(rec_addr));
+                size_t datagrams = (segment > 0)? (buffer.size() + segment - 1) / segment : 1;
+                if (len >= 0) {
+                    Trace::record(Trace::SENT, len, datagrams);
+                }
+                else if (errno == EWOULDBLOCK || errno == EAGAIN) {
+                    Trace::record(Trace::WOULD_BLOCK, buffer.size(), datagrams);
+                }
+                if (len < 0 && segment > 0 && (errno == EIO || errno == EINVAL || errno == EMSGSIZE ||
+                                               errno == ENOPROTOOPT)) {
+                    // e.g. no checksum offload on the route, the burst is packed again one by one
+                    std::cerr << last_err("Segmentation offload disabled: ") << std::endl;
+                    gso = false;
+                }
+                else if (len >= 0 || (errno != EWOULDBLOCK && errno != EAGAIN)) {
+                    gs.mark_sent();
                 }
             }
             want_to_write = gs.want_to_write();
         }
+        spectators.serve(fds.data() + 2, gs.round_history(), gs.round_game_id());
     }
 
     return 0;
@@ -0,0 +1,199 @@
+#include <new>
+#include <algorithm>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/un.h>
+#include "shm_channel.h"
+
+namespace {
+
+    size_t const REGION_SIZE = 2 * sizeof(ShmRing);
+
+    struct Greeting {
+        uint32_t magic;
+        uint32_t ring_size;
+    };
+
+    bool unix_address(std::string const &path, sockaddr_un &addr)
+    {
+        addr = {};
+        addr.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+            return false;
+        }
+        memcpy(addr.sun_path, path.data(), path.size());
+        return true;
+    }
+
+    void close_fds(int fds[], size_t n)
+    {
+        for (size_t i = 0; i < n; ++i) {
+            if (fds[i] != -1) {
+                close(fds[i]);
+            }
+        }
+    }
+}
+
+ShmChannel::ShmChannel() : own_wakeup{-1}, peer_wakeup{-1}, region{nullptr}, out{nullptr}, in{nullptr} {}
+
+ShmChannel::~ShmChannel()
+{
+    if (region != nullptr) {
+        munmap(region, REGION_SIZE);
+    }
+    int fds[] = {own_wakeup, peer_wakeup};
+    close_fds(fds, 2);
+}
+
+// first ring carries lines to the GUI, the second one key commands to the client
+bool ShmChannel::map(int memfd, bool client)
+{
+    region = mmap(nullptr, REGION_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (region == MAP_FAILED) {
+        region = nullptr;
+        return false;
+    }
+    ShmRing *rings = static_cast<ShmRing *>(region);
+    out = client? &rings[0] : &rings[1];
+    in = client? &rings[1] : &rings[0];
+    return true;
+}
+
+bool ShmChannel::connect(std::string const &path)
+{
+    sockaddr_un addr;
+    if (!unix_address(path, addr) || (control.fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 ||
+            ::connect(control.fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1) {
+        return false;
+    }
+
+    // memfd and the GUI's eventfd are needed here only until they are passed
+    int fds[3] = {memfd_create("siktacka-gui", 0),
+                  eventfd(0, EFD_NONBLOCK), eventfd(0, EFD_NONBLOCK)};
+    bool ok = fds[0] != -1 && fds[1] != -1 && fds[2] != -1 && ftruncate(fds[0], REGION_SIZE) == 0 &&
+              map(fds[0], true);
+    if (ok) {
+        ShmRing *rings = static_cast<ShmRing *>(region);
+        for (size_t i = 0; i < 2; ++i) {
+            new (&rings[i].head) std::atomic<uint64_t>(0);
+            new (&rings[i].tail) std::atomic<uint64_t>(0);
+        }
+        Greeting greeting = {SHM_CHANNEL_MAGIC, static_cast<uint32_t>(SHM_RING_SIZE)};
+        iovec iov = {&greeting, sizeof(greeting)};
+        char control_data[CMSG_SPACE(sizeof(fds))] = {};
+        msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control_data;
+        msg.msg_controllen = sizeof(control_data);
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+        ok = sendmsg(control.fd, &msg, 0) == sizeof(greeting);
+    }
+    peer_wakeup = fds[1];
+    own_wakeup = fds[2];
+    close_fds(fds, 1);
+    return ok && fcntl(control.fd, F_SETFL, O_NONBLOCK) == 0;
+}
+
+bool ShmChannel::accept(int listener)
+{
+    if ((control.fd = ::accept(listener, nullptr, nullptr)) == -1) {
+        return false;
+    }
+    Greeting greeting = {};
+    int fds[3] = {-1, -1, -1};
+    iovec iov = {&greeting, sizeof(greeting)};
+    char control_data[CMSG_SPACE(sizeof(fds))] = {};
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control_data;
+    msg.msg_controllen = sizeof(control_data);
+    if (recvmsg(control.fd, &msg, MSG_WAITALL) != sizeof(greeting)) {
+        return false;
+    }
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == nullptr || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        return false;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    own_wakeup = fds[1];
+    peer_wakeup = fds[2];
+    bool ok = greeting.magic == SHM_CHANNEL_MAGIC && greeting.ring_size == SHM_RING_SIZE &&
+              map(fds[0], false);
+    close_fds(fds, 1);
+    return ok && fcntl(control.fd, F_SETFL, O_NONBLOCK) == 0;
+}
+
+int ShmChannel::wakeup_fd() const
+{
+    return own_wakeup;
+}
+
+int ShmChannel::control_fd() const
+{
+    return control.fd;
+}
+
+void ShmChannel::clear_wakeups()
+{
+    uint64_t count;
+    while (::read(own_wakeup, &count, sizeof(count)) > 0) {}
+}
+
+void ShmChannel::wake_peer()
+{
+    uint64_t one = 1;
+    ssize_t ignored = ::write(peer_wakeup, &one, sizeof(one));
+    (void) ignored;
+}
+
+void ShmChannel::disconnect()
+{
+    // both sides see the control socket at end of file as if the other one was gone
+    shutdown(control.fd, SHUT_RDWR);
+}
+
+size_t ShmChannel::write(char const *data, size_t len)
+{
+    uint64_t tail = out->tail.load(std::memory_order_relaxed);
+    uint64_t head = out->head.load(std::memory_order_acquire);
+    // positions are shared with the other side, it mustn't make data be written out of the ring
+    if (head > tail || tail - head > SHM_RING_SIZE) {
+        disconnect();
+        return 0;
+    }
+    len = std::min<size_t>(len, SHM_RING_SIZE - (tail - head));
+    size_t pos = tail % SHM_RING_SIZE, first = std::min(len, SHM_RING_SIZE - pos);
+    memcpy(&out->data[pos], data, first);
+    memcpy(&out->data[0], data + first, len - first);
+    if (len > 0) {
+        out->tail.store(tail + len, std::memory_order_release);
+        wake_peer();
+    }
+    return len;
+}
+
+size_t ShmChannel::read(char *data, size_t len)
+{
+    uint64_t head = in->head.load(std::memory_order_relaxed);
+    uint64_t tail = in->tail.load(std::memory_order_acquire);
+    if (head > tail || tail - head > SHM_RING_SIZE) {
+        disconnect();
+        return 0;
+    }
+    len = std::min<size_t>(len, tail - head);
+    size_t pos = head % SHM_RING_SIZE, first = std::min(len, SHM_RING_SIZE - pos);
+    memcpy(data, &in->data[pos], first);
+    memcpy(data + first, &in->data[0], len - first);
+    if (len > 0) {
+        in->head.store(head + len, std::memory_order_release);
+        wake_peer();
+    }
+    return len;
+}
@@ -0,0 +1,60 @@
+#ifndef II_SHM_CHANNEL_H
+#define II_SHM_CHANNEL_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include "utils.h"
+
+/* Byte streams both ways between the client and a GUI on the same host, passed through shared
+ * memory instead of loopback TCP. The client creates a memfd holding a single producer single
+ * consumer ring per direction and an eventfd per side, and passes them with SCM_RIGHTS over
+ * the GUI's unix socket. The socket then only tells that the other side is gone. Lines are
+ * the same as over TCP. */
+
+uint32_t const SHM_CHANNEL_MAGIC = 0x534b4731; // "SKG1"
+size_t const SHM_RING_SIZE = 65536; // power of two
+
+/* Ring header in shared memory, positions only grow and are taken modulo SHM_RING_SIZE */
+struct ShmRing {
+    alignas(64) std::atomic<uint64_t> head; // advanced by the consumer
+    alignas(64) std::atomic<uint64_t> tail; // advanced by the producer
+    alignas(64) char data[SHM_RING_SIZE];
+};
+
+class ShmChannel {
+    Socket control;
+    int own_wakeup, peer_wakeup; // eventfds
+    void *region;
+    ShmRing *out, *in;
+
+    bool map(int memfd, bool client);
+    void wake_peer();
+    void disconnect();
+
+public:
+    ShmChannel();
+    ~ShmChannel();
+
+    // client side, connects to the GUI listening at path
+    bool connect(std::string const &path);
+    // GUI side, takes a client connecting to listener
+    bool accept(int listener);
+
+    // readable when the other side wrote or read something
+    int wakeup_fd() const;
+    // readable (at end of file) when the other side is gone
+    int control_fd() const;
+    void clear_wakeups();
+
+    // ring positions which can't be right make both write and read take nothing and leave
+    // control_fd readable on both sides, as if the other side was gone
+
+    // as much of data as fits, wakes the other side if anything was written
+    size_t write(char const *data, size_t len);
+    // at most len bytes, wakes the other side if anything was read
+    size_t read(char *data, size_t len);
+
+};
+
+#endif //II_SHM_CHANNEL_H
@@ -0,0 +1,190 @@
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <cstdint>
+#include <ctime>
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+#include "utils.h"
+#include "simulator.h"
+
+namespace {
+
+    int32_t const LOOKAHEAD = 12; //steps avoid bot checks ahead
+
+    // steps snake survives when keeping turn for all of them, approximated in floating point
+    int32_t free_run(Round const &round, size_t player, int32_t turn)
+    {
+        SnakeArrays const &s = round.snake_state();
+        Board const &b = round.get_board();
+        double x = s.x[player], y = s.y[player];
+        if (b.physics == Physics::FIXED) {
+            x = static_cast<double>(s.fx[player]) / FixedPoint::ONE;
+            y = static_cast<double>(s.fy[player]) / FixedPoint::ONE;
+        }
+        int32_t d = s.direction[player], ts = b.turning_speed;
+        Position last{s.px[player], s.py[player]};
+        for (int32_t step = 0; step < LOOKAHEAD; ++step) {
+            d = (d + 360 + turn * ts) % 360;
+            x += std::cos(M_PI * d / 180.);
+            y += std::sin(M_PI * d / 180.);
+            if (x < 0 || y < 0) {
+                return step;
+            }
+            Position p{static_cast<uint32_t>(x), static_cast<uint32_t>(y)};
+            if (p != last) {
+                if (round.is_taken(p)) {
+                    return step;
+                }
+                last = p;
+            }
+        }
+        return LOOKAHEAD;
+    }
+
+    int32_t straight(Round const &, size_t)
+    {
+        return 0;
+    }
+
+    // changes its mind depending on where it is, so rounds stay reproducible
+    int32_t wander(Round const &round, size_t player)
+    {
+        SnakeArrays const &s = round.snake_state();
+        uint64_t h = (static_cast<uint64_t>(s.px[player]) * 2654435761u) ^ (s.py[player] * 40503u) ^ player;
+        return static_cast<int32_t>(h % 3) - 1;
+    }
+
+    // goes straight unless turning keeps it alive longer
+    int32_t avoid(Round const &round, size_t player)
+    {
+        int32_t best = 0, best_run = free_run(round, player, 0);
+        for (int32_t turn : {-1, 1}) {
+            if (best_run == LOOKAHEAD) {
+                break;
+            }
+            int32_t run = free_run(round, player, turn);
+            if (run > best_run) {
+                best = turn;
+                best_run = run;
+            }
+        }
+        return best;
+    }
+
+    bool bot_by_name(std::string const &name, Bot &bot)
+    {
+        if (name == "straight") {
+            bot = straight;
+        }
+        else if (name == "wander") {
+            bot = wander;
+        }
+        else if (name == "avoid") {
+            bot = avoid;
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+
+    /* Parsing arguments */
+    uint32_t width = 800, height = 600, tspeed = 6,
+            seed = static_cast<uint32_t >(time(NULL) % Generator::MOD),
+            rounds = 1000, max_cycles = 100000,
+            threads = std::max(1u, std::thread::hardware_concurrency());
+    Physics physics = Physics::FLOATING;
+    int opt;
+    while ((opt = getopt(argc, argv, "W:H:t:r:n:c:j:f")) != -1) {
+        uint32_t parsed;
+        if (opt == 'f') {
+            physics = Physics::FIXED;
+            continue;
+        }
+        if (optarg == NULL) {
+            return 1;
+        }
+        try {
+            parsed = str2uint32_t(optarg);
+        } catch (UtilsError const &e) {
+            std::cerr << static_cast<char>(opt) << ": " << e.what() << std::endl;
+            return 1;
+        }
+        switch (opt) {
+            case 'W':
+                width = parsed;
+                break;
+            case 'H':
+                height = parsed;
+                break;
+            case 't':
+                tspeed = parsed;
+                break;
+            case 'r':
+                seed = parsed;
+                break;
+            case 'n':
+                rounds = parsed;
+                break;
+            case 'c':
+                max_cycles = parsed;
+                break;
+            case 'j':
+                threads = parsed;
+                break;
+            default:
+                std::cerr << "Usage " << argv[0] << " [-W n] [-H n] [-t n] [-r n] [-n rounds]"
+                          << " [-c max_cycles] [-j threads] [-f] bot bot..." << std::endl;
+                return 1;
+        }
+    }
+
+    /* Purpose specific validation of arguments */
+
+    if (tspeed >= 360) {
+        std::cerr << "Turning speed should be in [0, 360) range" << std::endl;
+        return 1;
+    }
+
+    if (width == 0 || height == 0) {
+        std::cerr << "Board can't be empty" << std::endl;
+        return 1;
+    }
+
+    std::vector<Bot> bots;
+    std::vector<std::string> names;
+    for (int i = optind; i < argc; ++i) {
+        Bot bot;
+        if (!bot_by_name(argv[i], bot)) {
+            std::cerr << "Unknown bot " << argv[i] << ", known are: straight wander avoid" << std::endl;
+            return 1;
+        }
+        bots.push_back(bot);
+        names.push_back(argv[i]);
+    }
+    if (bots.size() < 2 || bots.size() > MAX_PLAYERS) {
+        std::cerr << "Round needs from 2 to " << MAX_PLAYERS << " bots" << std::endl;
+        return 1;
+    }
+
+    /* Simulation */
+    Board board{1, tspeed, width, height, physics};
+    uint64_t started = milliseconds_since_epoch();
+    SimulationResult result = simulate_rounds(board, bots, seed, rounds, max_cycles, threads);
+    uint64_t elapsed = std::max<uint64_t>(1, milliseconds_since_epoch() - started);
+
+    std::cout << "seed " << seed << " rounds " << result.rounds << " cycles " << result.cycles
+              << " unfinished " << result.unfinished << std::endl;
+    for (size_t i = 0; i < bots.size(); ++i) {
+        std::cout << "bot" << i << " " << names[i] << " wins " << result.wins[i] << std::endl;
+    }
+    std::cout << elapsed << " ms, " << result.rounds * 1000 / elapsed << " rounds/s on "
+              << threads << " threads" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,159 @@
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <algorithm>
+#include <string>
+#include "simulator.h"
+
+namespace {
+
+    /* Rounds left to a worker as [begin, end) packed into one word, so that the owner taking
+     * from the front and thieves taking the back half agree with a single compare and swap */
+    struct Range {
+        std::atomic<uint64_t> packed;
+        char padding[64 - sizeof(std::atomic<uint64_t>)]; // no false sharing between workers
+
+        Range() : packed{0} {}
+
+        static uint64_t pack(uint64_t begin, uint64_t end)
+        {
+            return begin << 32 | end;
+        }
+
+        void set(uint64_t begin, uint64_t end)
+        {
+            packed.store(pack(begin, end));
+        }
+
+        bool take(uint64_t &round)
+        {
+            uint64_t v = packed.load();
+            while ((v >> 32) < (v & UINT32_MAX)) {
+                if (packed.compare_exchange_weak(v, pack((v >> 32) + 1, v & UINT32_MAX))) {
+                    round = v >> 32;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool steal_half(uint64_t &begin, uint64_t &end)
+        {
+            uint64_t v = packed.load();
+            while ((v >> 32) < (v & UINT32_MAX)) {
+                uint64_t b = v >> 32, e = v & UINT32_MAX, half = (e - b + 1) / 2;
+                if (packed.compare_exchange_weak(v, pack(b, e - half))) {
+                    begin = e - half;
+                    end = e;
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    class Worker {
+        Board const &board;
+        std::vector<Bot> const &bots;
+        uint32_t seed;
+        uint64_t max_cycles;
+        std::vector<EagerPlayer> eager;
+        Round round;
+
+    public:
+        SimulationResult result;
+
+        Worker(Board const &board, std::vector<Bot> const &bots, uint32_t seed, uint64_t max_cycles)
+                : board(board), bots(bots), seed{seed}, max_cycles{max_cycles}, result(bots.size())
+        {
+            for (size_t i = 0; i < bots.size(); ++i) {
+                eager.push_back(EagerPlayer{"bot" + std::to_string(i), 0, i});
+            }
+        }
+
+        void play(uint64_t round_no)
+        {
+            Generator random(seed);
+            random.jump(round_no * ROUND_DRAWS);
+            round.start(board, eager, random);
+            SnakeArrays const &snakes = round.snake_state();
+            uint64_t cycles = 0;
+            for (; std::get<1>(round.is_active()) && cycles < max_cycles; ++cycles) {
+                for (size_t p = 0; p < bots.size(); ++p) {
+                    if (!snakes.eliminated[p]) {
+                        round.direction(p, static_cast<uint32_t>(bots[p](round, p)));
+                    }
+                }
+                round.cycle();
+            }
+            ++result.rounds;
+            result.cycles += cycles;
+            if (std::get<1>(round.is_active())) {
+                ++result.unfinished;
+                return;
+            }
+            for (size_t p = 0; p < bots.size(); ++p) {
+                if (!snakes.eliminated[p]) {
+                    ++result.wins[p];
+                }
+            }
+        }
+
+        // plays own rounds first, then steals from the others until nothing is left
+        void run(std::vector<Range> &ranges, size_t id)
+        {
+            uint64_t round_no, begin, end;
+            while (true) {
+                while (ranges[id].take(round_no)) {
+                    play(round_no);
+                }
+                bool stolen = false;
+                for (size_t i = 1; i < ranges.size() && !stolen; ++i) {
+                    stolen = ranges[(id + i) % ranges.size()].steal_half(begin, end);
+                }
+                if (!stolen) {
+                    return;
+                }
+                ranges[id].set(begin, end);
+            }
+        }
+    };
+}
+
+SimulationResult::SimulationResult(size_t bots) : rounds{0}, cycles{0}, unfinished{0}, wins(bots, 0) {}
+
+void SimulationResult::merge(SimulationResult const &other)
+{
+    rounds += other.rounds;
+    cycles += other.cycles;
+    unfinished += other.unfinished;
+    for (size_t i = 0; i < wins.size(); ++i) {
+        wins[i] += other.wins[i];
+    }
+}
+
+SimulationResult simulate_rounds(Board const &board, std::vector<Bot> const &bots, uint32_t seed,
+                                 uint64_t rounds, uint64_t max_cycles, size_t threads)
+{
+    threads = std::max<size_t>(1, threads);
+    rounds = std::min<uint64_t>(rounds, UINT32_MAX);
+    std::vector<Range> ranges(threads);
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (size_t i = 0; i < threads; ++i) {
+        ranges[i].set(rounds * i / threads, rounds * (i + 1) / threads);
+        workers.emplace_back(new Worker(board, bots, seed, max_cycles));
+    }
+    std::vector<std::thread> pool;
+    for (size_t i = 1; i < threads; ++i) {
+        pool.emplace_back(&Worker::run, workers[i].get(), std::ref(ranges), i);
+    }
+    workers[0]->run(ranges, 0);
+    SimulationResult result(bots.size());
+    for (size_t i = 0; i < threads; ++i) {
+        if (i > 0) {
+            pool[i - 1].join();
+        }
+        result.merge(workers[i]->result);
+    }
+    return result;
+}
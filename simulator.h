@@ -0,0 +1,31 @@
+#ifndef II_SIMULATOR_H
+#define II_SIMULATOR_H
+
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include "game_state.h"
+
+/* Headless rounds played by bots instead of networked players, as fast as cores allow */
+
+// Turn direction {-1, 0, 1} of the player's snake for the next cycle. Called concurrently
+// from many threads, so it shouldn't touch shared mutable state.
+using Bot = std::function<int32_t(Round const &round, size_t player)>;
+
+struct SimulationResult {
+    uint64_t rounds;
+    uint64_t cycles;
+    uint64_t unfinished; //rounds stopped after max_cycles
+    std::vector<uint64_t> wins; //indexed as bots
+
+    SimulationResult(size_t bots);
+    void merge(SimulationResult const &other);
+};
+
+// Plays rounds numbered [0, rounds) with one snake per bot on a work-stealing pool of threads.
+// Round i draws from its own stream: Generator(seed) moved ahead by i * ROUND_DRAWS, so results
+// don't depend on the number of threads.
+SimulationResult simulate_rounds(Board const &board, std::vector<Bot> const &bots, uint32_t seed,
+                                 uint64_t rounds, uint64_t max_cycles, size_t threads);
+
+#endif //II_SIMULATOR_H
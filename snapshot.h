@@ -0,0 +1,132 @@
+#ifndef II_SNAPSHOT_H
+#define II_SNAPSHOT_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <type_traits>
+
+/* Flat image of server state in native byte order, read back only by a process of the same
+ * machine taking over the game */
+
+uint32_t const SNAPSHOT_MAGIC = 0x534b5332; // "SKS2", bumped whenever the layout changes
+
+class SnapshotWriter {
+    std::string data;
+
+    template<class T>
+    void put_all(std::vector<T> const &values, std::true_type)
+    {
+        data.append(reinterpret_cast<char const *>(values.data()), values.size() * sizeof(T));
+    }
+
+    template<class T>
+    void put_all(std::vector<T> const &values, std::false_type)
+    {
+        for (auto const &v : values) {
+            put(v);
+        }
+    }
+
+public:
+    template<class T>
+    void put(T const &value)
+    {
+        static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value ||
+                      std::is_pod<T>::value, "only plain values are copied as they are");
+        data.append(reinterpret_cast<char const *>(&value), sizeof(value));
+    }
+
+    template<class T>
+    void put(std::vector<T> const &values)
+    {
+        put<uint64_t>(values.size());
+        put_all(values, std::is_arithmetic<T>());
+    }
+
+    void put(std::string const &s)
+    {
+        put<uint64_t>(s.size());
+        data += s;
+    }
+
+    std::string const &str() const
+    {
+        return data;
+    }
+};
+
+class SnapshotReader {
+    char const *pos, *end;
+    bool good;
+
+    template<class T>
+    void get_all(std::vector<T> &values, std::true_type)
+    {
+        memcpy(values.data(), pos, values.size() * sizeof(T));
+        pos += values.size() * sizeof(T);
+    }
+
+    template<class T>
+    void get_all(std::vector<T> &values, std::false_type)
+    {
+        for (auto &v : values) {
+            get(v);
+        }
+    }
+
+public:
+    SnapshotReader(std::string const &data) : pos{data.data()}, end{data.data() + data.size()}, good{true} {}
+
+    // false once anything was read past the end, values read then are zeroed
+    bool ok() const
+    {
+        return good;
+    }
+
+    template<class T>
+    void get(T &value)
+    {
+        static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value ||
+                      std::is_pod<T>::value, "only plain values are copied as they are");
+        if (static_cast<size_t>(end - pos) < sizeof(value)) {
+            good = false;
+            memset(&value, 0, sizeof(value));
+            return;
+        }
+        memcpy(&value, pos, sizeof(value));
+        pos += sizeof(value);
+    }
+
+    template<class T>
+    void get(std::vector<T> &values)
+    {
+        uint64_t size = 0;
+        get(size);
+        values.clear();
+        // every value takes at least a byte, so corrupted size can't exhaust memory
+        if (size > static_cast<uint64_t>(end - pos) ||
+                (std::is_arithmetic<T>::value && size * sizeof(T) > static_cast<uint64_t>(end - pos))) {
+            good = false;
+            return;
+        }
+        values.resize(size);
+        get_all(values, std::is_arithmetic<T>());
+    }
+
+    void get(std::string &s)
+    {
+        uint64_t size = 0;
+        get(size);
+        if (size > static_cast<uint64_t>(end - pos)) {
+            good = false;
+            s.clear();
+            return;
+        }
+        s.assign(pos, size);
+        pos += size;
+    }
+};
+
+#endif //II_SNAPSHOT_H
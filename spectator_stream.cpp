@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <sys/socket.h>
+#include "spectator_stream.h"
+
+namespace {
+
+    size_t const DISCARD_BUFFER_SIZE = 4096;
+}
+
+SpectatorStream::Spectator::Spectator(int fd)
+        : blocked{false}, reading{true}, backlog_written{0}, header_written{0}, offset{0}
+{
+    sock.fd = fd;
+}
+
+SpectatorStream::SpectatorStream() : accepting{true} {}
+
+bool SpectatorStream::listen(uint32_t port)
+{
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    AddrInfo info(nullptr, std::to_string(port).c_str(), hints);
+    if (!info.info) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // IPv6 socket takes IPv4 connections too, IPv4 one is the fallback
+    for (auto family : {AF_INET6, AF_INET}) {
+        for (addrinfo *p = info.info; p != NULL && listener.fd == -1; p = p->ai_next) {
+            if (p->ai_family != family) {
+                continue;
+            }
+            Socket try_socket;
+            int flag = 1;
+            // server taking over by handoff listens along until its predecessor exits
+            if ((try_socket.fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1 ||
+                    setsockopt(try_socket.fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag)) == -1 ||
+                    setsockopt(try_socket.fd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag)) == -1 ||
+                    bind(try_socket.fd, p->ai_addr, p->ai_addrlen) == -1 ||
+                    ::listen(try_socket.fd, SOMAXCONN) == -1 ||
+                    fcntl(try_socket.fd, F_SETFL, O_NONBLOCK) == -1) {
+                continue;
+            }
+            listener = std::move(try_socket);
+        }
+    }
+    reserve.fd = open("/dev/null", O_RDONLY);
+    return listener.fd != -1;
+}
+
+size_t SpectatorStream::count() const
+{
+    return spectators.size();
+}
+
+void SpectatorStream::add_to_poll(std::vector<pollfd> &fds) const
+{
+    if (listener.fd == -1) {
+        return;
+    }
+    // negative descriptor keeps the place, poll ignores it
+    fds.push_back(pollfd{accepting? listener.fd : -1, POLLIN, 0});
+    for (auto &s : spectators) {
+        short events = (s.reading? POLLIN : 0) | (s.blocked? POLLOUT : 0);
+        fds.push_back(pollfd{s.sock.fd, events, 0});
+    }
+}
+
+void SpectatorStream::accept_all()
+{
+    int fd;
+    while ((fd = accept4(listener.fd, nullptr, nullptr, SOCK_NONBLOCK)) != -1) {
+        spectators.emplace_back(fd);
+    }
+    if (errno != EMFILE && errno != ENFILE) {
+        return;
+    }
+    if (reserve.fd == -1) {
+        accepting = false;
+        return;
+    }
+    // connection is refused by closing it, the rest waits for the next poll
+    close(reserve.fd);
+    if ((fd = accept(listener.fd, nullptr, nullptr)) != -1) {
+        close(fd);
+    }
+    reserve.fd = open("/dev/null", O_RDONLY);
+}
+
+// false once the connection has failed
+bool SpectatorStream::discard_input(Spectator &s)
+{
+    char buffer[DISCARD_BUFFER_SIZE];
+    while (true) {
+        ssize_t got = recv(s.sock.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (got == 0) {
+            // half closed connection still gets events
+            s.reading = false;
+            return true;
+        }
+        if (got < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+    }
+}
+
+// false once the connection has failed
+bool SpectatorStream::write_some(Spectator &s, Event::History const &history, uint32_t game_id)
+{
+    uint32_t header = bswap(game_id);
+    iovec iov[3];
+    int cnt = 0;
+    if (s.backlog_written < s.backlog.size()) {
+        iov[cnt++] = iovec{&s.backlog[s.backlog_written], s.backlog.size() - s.backlog_written};
+    }
+    // round is streamed once it has its NEW_GAME
+    if (history.size() > 0) {
+        if (s.header_written < sizeof(header)) {
+            iov[cnt++] = iovec{reinterpret_cast<char *>(&header) + s.header_written, sizeof(header) - s.header_written};
+        }
+        if (s.offset < history.events.size()) {
+            iov[cnt++] = iovec{const_cast<char *>(&history.events[s.offset]), history.events.size() - s.offset};
+        }
+    }
+    if (cnt == 0) {
+        return true;
+    }
+    msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = cnt;
+    // gathered write as writev, but a connection closed meanwhile doesn't raise SIGPIPE
+    ssize_t written = sendmsg(s.sock.fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (written < 0) {
+        s.blocked = errno == EAGAIN || errno == EWOULDBLOCK;
+        return s.blocked || errno == EINTR;
+    }
+    size_t left = written, total = 0;
+    for (int i = 0; i < cnt; ++i) {
+        total += iov[i].iov_len;
+    }
+    s.blocked = left < total;
+    size_t n = std::min(left, s.backlog.size() - s.backlog_written);
+    s.backlog_written += n;
+    left -= n;
+    if (s.backlog_written == s.backlog.size()) {
+        s.backlog.clear();
+        s.backlog_written = 0;
+    }
+    if (history.size() > 0) {
+        n = std::min(left, sizeof(header) - s.header_written);
+        s.header_written += n;
+        s.offset += left - n;
+    }
+    return true;
+}
+
+void SpectatorStream::drop_closed()
+{
+    auto end = std::remove_if(spectators.begin(), spectators.end(),
+                              [](Spectator const &s) { return s.sock.fd == -1; });
+    if (end == spectators.end()) {
+        return;
+    }
+    spectators.erase(end, spectators.end());
+    // descriptor freed lets the listener take connections again
+    accepting = true;
+    if (reserve.fd == -1) {
+        reserve.fd = open("/dev/null", O_RDONLY);
+    }
+}
+
+void SpectatorStream::serve(pollfd const *fds, Event::History const &history, uint32_t game_id)
+{
+    if (listener.fd == -1) {
+        return;
+    }
+    size_t polled = spectators.size();
+    if (fds[0].revents & POLLIN) {
+        accept_all();
+    }
+    // new connections are written to right away, they have nothing to wait for
+    for (size_t i = 0; i < spectators.size(); ++i) {
+        Spectator &s = spectators[i];
+        if (s.sock.fd == -1) {
+            continue;
+        }
+        short revents = (i < polled)? fds[i + 1].revents : 0;
+        bool open = !(revents & (POLLERR | POLLNVAL));
+        if (open && (revents & (POLLIN | POLLHUP)) && s.reading) {
+            open = discard_input(s);
+        }
+        if (revents & (POLLOUT | POLLHUP)) {
+            s.blocked = false;
+        }
+        if (open && !s.blocked) {
+            open = write_some(s, history, game_id);
+        }
+        if (!open) {
+            close(s.sock.fd);
+            s.sock.fd = -1;
+        }
+    }
+    drop_closed();
+}
+
+void SpectatorStream::round_replaced(Event::History const &history, uint32_t game_id)
+{
+    uint32_t header = bswap(game_id);
+    for (auto &s : spectators) {
+        if (s.sock.fd == -1) {
+            continue;
+        }
+        // connection which got nothing of the round skips it
+        if (s.header_written > 0) {
+            s.backlog.erase(0, s.backlog_written);
+            s.backlog_written = 0;
+            s.backlog.append(reinterpret_cast<char *>(&header) + s.header_written, sizeof(header) - s.header_written);
+            s.backlog.append(&history.events[0] + s.offset, history.events.size() - s.offset);
+        }
+        s.header_written = 0;
+        s.offset = 0;
+        if (s.backlog.size() > MAX_SPECTATOR_BACKLOG) {
+            close(s.sock.fd);
+            s.sock.fd = -1;
+        }
+    }
+    // closed connections are dropped by serve, until then they match pollfds taken before
+}
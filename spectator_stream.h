@@ -0,0 +1,60 @@
+#ifndef II_SPECTATOR_STREAM_H
+#define II_SPECTATOR_STREAM_H
+
+#include <vector>
+#include <string>
+#include <poll.h>
+#include "utils.h"
+#include "events.h"
+
+/* Watch-only TCP connections, each gets every round as its game id (4 bytes) followed by its
+ * framed events exactly as they are in history. Events are written straight from history, so
+ * a connection costs only its position in it; one which can't take more is simply written to
+ * later. Spectators send nothing, anything they do send is ignored. */
+
+// rest of a replaced round kept for a connection which hasn't got it yet, beyond it it's dropped
+size_t const MAX_SPECTATOR_BACKLOG = 1 << 20;
+
+class SpectatorStream {
+    struct Spectator {
+        Socket sock;
+        bool blocked; // waits for POLLOUT
+        bool reading; // spectator hasn't shut down its side yet
+        std::string backlog; // end of the previous round
+        size_t backlog_written;
+        size_t header_written; // bytes of game id of the current round
+        size_t offset; // bytes of history of the current round
+
+        Spectator(int fd);
+    };
+
+    Socket listener;
+    // given up to take and close a connection when out of descriptors, which would otherwise
+    // keep the listener readable
+    Socket reserve;
+    bool accepting; // listener is polled, stops while out of descriptors without a reserve one
+    std::vector<Spectator> spectators;
+
+    void accept_all();
+    bool discard_input(Spectator &s);
+    bool write_some(Spectator &s, Event::History const &history, uint32_t game_id);
+    void drop_closed();
+
+public:
+    SpectatorStream();
+
+    // listens on port of any address family, false with errno set on failure
+    bool listen(uint32_t port);
+    size_t count() const;
+
+    // appends listener and every connection, in this order, to fds
+    void add_to_poll(std::vector<pollfd> &fds) const;
+    // takes new connections, drops closed ones and writes to every one that takes more,
+    // fds are those added by add_to_poll
+    void serve(pollfd const *fds, Event::History const &history, uint32_t game_id);
+    // keeps what connections lack of the round which is about to be replaced, those which lack
+    // too much are closed and dropped by the next serve
+    void round_replaced(Event::History const &history, uint32_t game_id);
+};
+
+#endif //II_SPECTATOR_STREAM_H
@@ -0,0 +1,51 @@
+#ifndef II_SPSC_QUEUE_H
+#define II_SPSC_QUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+/* Bounded lock-free queue for exactly one producer thread and one consumer thread */
+template<class T>
+class SpscQueue {
+    std::vector<T> slots;
+    size_t mask;
+    // each index is written by one side only, kept apart to avoid false sharing
+    alignas(64) std::atomic<size_t> head; // next slot to pop
+    alignas(64) std::atomic<size_t> tail; // next slot to push
+
+public:
+    // capacity has to be a power of two
+    SpscQueue(size_t capacity) : slots(capacity), mask{capacity - 1}, head{0}, tail{0} {}
+
+    // moves value in, false if the queue is full
+    bool push(T &value)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == slots.size()) {
+            return false;
+        }
+        slots[t & mask] = std::move(value);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // moves the oldest value out, false if the queue is empty
+    bool pop(T &value)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = std::move(slots[h & mask]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool full() const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire) == slots.size();
+    }
+};
+
+#endif //II_SPSC_QUEUE_H
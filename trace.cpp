@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "trace.h"
+
+namespace {
+
+    struct Ring {
+        Trace::RingHeader header;
+        std::atomic<uint64_t> written; // published to header when dumping
+        Trace::Record records[Trace::RING_SIZE];
+    };
+
+    Ring rings[Trace::MAX_THREADS];
+    std::atomic<size_t> rings_taken{0};
+    thread_local Ring *own_ring = nullptr;
+    thread_local bool no_ring = false;
+
+    size_t const MAX_PATH = 256;
+    char dump_path[MAX_PATH];
+
+    Ring *ring()
+    {
+        if (own_ring == nullptr && !no_ring) {
+            size_t id = rings_taken.fetch_add(1);
+            if (id >= Trace::MAX_THREADS) {
+                no_ring = true;
+                return nullptr;
+            }
+            own_ring = &rings[id];
+            own_ring->header.thread = static_cast<uint64_t>(syscall(SYS_gettid));
+        }
+        return own_ring;
+    }
+
+    bool write_all(int fd, void const *data, size_t len)
+    {
+        char const *pos = static_cast<char const *>(data);
+        while (len > 0) {
+            ssize_t written = write(fd, pos, len);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                return false;
+            }
+            pos += written;
+            len -= written;
+        }
+        return true;
+    }
+
+    void dump_requested(int)
+    {
+        int saved = errno;
+        Trace::dump(dump_path);
+        errno = saved;
+    }
+
+    // handler is reset on delivery, so raising the signal again ends the process as it would
+    void crashed(int sig)
+    {
+        Trace::dump(dump_path);
+        raise(sig);
+    }
+}
+
+void Trace::record(Type type, uint64_t a, uint64_t b)
+{
+    Ring *r = ring();
+    if (r == nullptr) {
+        return;
+    }
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    // only the owner writes to the ring, dump may race with it and see a torn record at worst
+    uint64_t n = r->written.load(std::memory_order_relaxed);
+    Record &rec = r->records[n & (RING_SIZE - 1)];
+    rec.time = static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+    rec.type = type;
+    rec.a = a;
+    rec.b = b;
+    r->written.store(n + 1, std::memory_order_release);
+}
+
+bool Trace::dump(char const *path)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    uint32_t count = std::min(rings_taken.load(), MAX_THREADS);
+    uint32_t header[3] = {MAGIC, sizeof(Record), count};
+    bool ok = write_all(fd, header, sizeof(header));
+    for (uint32_t i = 0; i < count && ok; ++i) {
+        rings[i].header.written = rings[i].written.load(std::memory_order_acquire);
+        ok = write_all(fd, &rings[i].header, sizeof(RingHeader)) &&
+             write_all(fd, rings[i].records, sizeof(rings[i].records));
+    }
+    close(fd);
+    return ok;
+}
+
+bool Trace::dump_on_signals(char const *path)
+{
+    if (strlen(path) >= MAX_PATH) {
+        return false;
+    }
+    strcpy(dump_path, path);
+    struct sigaction sa = {};
+    sa.sa_handler = dump_requested;
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(SIGUSR2, &sa, nullptr) == -1) {
+        return false;
+    }
+    sa.sa_handler = crashed;
+    sa.sa_flags = SA_RESETHAND;
+    for (int sig : {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT}) {
+        if (sigaction(sig, &sa, nullptr) == -1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+char const *Trace::type_name(uint16_t type)
+{
+    static char const *names[] = {"?", "RECEIVED", "CONNECTED", "DISCONNECTED", "TICK_START",
+                                  "TICK_END", "SENT", "WOULD_BLOCK", "OVERLOAD"};
+    return type < TYPES_END? names[type] : names[0];
+}
@@ -0,0 +1,55 @@
+#ifndef II_TRACE_H
+#define II_TRACE_H
+
+#include <cstdint>
+#include <cstddef>
+
+/* Binary trace of what the server did recently. Every thread writes fixed size records to its
+ * own ring, older records get overwritten. Rings are dumped to a file on demand (SIGUSR2) or
+ * on crash and turned into a timeline by siktacka-trace. */
+
+namespace Trace {
+
+    uint32_t const MAGIC = 0x534b5431; // "SKT1"
+    size_t const RING_SIZE = 4096; // records per thread, power of two
+    size_t const MAX_THREADS = 8; // records of threads beyond that are dropped
+
+    enum Type : uint16_t {
+        RECEIVED = 1,   // a: session id, b: next expected event number
+        CONNECTED,      // a: session id, b: inner player id
+        DISCONNECTED,   // a: session id, b: inner player id
+        TICK_START,     // a: game id, b: events in history
+        TICK_END,       // a: game id, b: events in history
+        SENT,           // a: bytes, b: datagrams in the buffer
+        WOULD_BLOCK,    // a: bytes, b: datagrams in the buffer
+        OVERLOAD,       // a: shedding level, b: players passed over
+        TYPES_END
+    };
+
+    struct Record {
+        uint64_t time; // ns of monotonic clock
+        uint16_t type;
+        uint16_t padding[3];
+        uint64_t a, b;
+    };
+
+    /* Dump layout: MAGIC, record size and number of rings (uint32_t each), then every ring as
+     * its thread id and number of records ever written to it (uint64_t each) followed by
+     * RING_SIZE records, record number n being at n % RING_SIZE */
+    struct RingHeader {
+        uint64_t thread;
+        uint64_t written;
+    };
+
+    void record(Type type, uint64_t a = 0, uint64_t b = 0);
+
+    // writes all rings to path, safe to call from a signal handler
+    bool dump(char const *path);
+
+    // dumps to path on SIGUSR2 and when the process crashes
+    bool dump_on_signals(char const *path);
+
+    char const *type_name(uint16_t type);
+}
+
+#endif //II_TRACE_H
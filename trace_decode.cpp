@@ -0,0 +1,70 @@
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include "trace.h"
+
+namespace {
+
+    struct Entry {
+        Trace::Record record;
+        uint64_t thread;
+    };
+
+    char const *arg_names[][2] = {{"a", "b"}, {"session", "expected"}, {"session", "player"},
+                                  {"session", "player"}, {"game", "events"}, {"game", "events"},
+                                  {"bytes", "datagrams"}, {"bytes", "datagrams"}, {"level", "passed"}};
+
+    bool read_dump(char const *path, std::vector<Entry> &entries)
+    {
+        std::ifstream in(path, std::ios::binary);
+        uint32_t header[3];
+        if (!in.read(reinterpret_cast<char *>(header), sizeof(header)) ||
+                header[0] != Trace::MAGIC || header[1] != sizeof(Trace::Record)) {
+            return false;
+        }
+        std::vector<Trace::Record> records(Trace::RING_SIZE);
+        for (uint32_t i = 0; i < header[2]; ++i) {
+            Trace::RingHeader ring;
+            if (!in.read(reinterpret_cast<char *>(&ring), sizeof(ring)) ||
+                    !in.read(reinterpret_cast<char *>(records.data()), records.size() * sizeof(Trace::Record))) {
+                return false;
+            }
+            uint64_t first = ring.written > Trace::RING_SIZE? ring.written - Trace::RING_SIZE : 0;
+            for (uint64_t n = first; n < ring.written; ++n) {
+                entries.push_back(Entry{records[n & (Trace::RING_SIZE - 1)], ring.thread});
+            }
+        }
+        return true;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        std::cerr << "Usage " << argv[0] << " trace_dump" << std::endl;
+        return 1;
+    }
+    std::vector<Entry> entries;
+    if (!read_dump(argv[1], entries)) {
+        std::cerr << "Not a trace dump: " << argv[1] << std::endl;
+        return 1;
+    }
+    std::stable_sort(entries.begin(), entries.end(), [](Entry const &e1, Entry const &e2) {
+        return e1.record.time < e2.record.time;
+    });
+
+    // times relative to the oldest record kept
+    uint64_t start = entries.empty()? 0 : entries.front().record.time;
+    for (auto const &e : entries) {
+        Trace::Record const &r = e.record;
+        uint16_t type = r.type < Trace::TYPES_END? r.type : 0;
+        printf("%14.6f ms  thread %-6llu %-13s %s=%llu %s=%llu\n", (r.time - start) / 1e6,
+               static_cast<unsigned long long>(e.thread), Trace::type_name(type),
+               arg_names[type][0], static_cast<unsigned long long>(r.a),
+               arg_names[type][1], static_cast<unsigned long long>(r.b));
+    }
+    return 0;
+}
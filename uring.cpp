@@ -0,0 +1,204 @@
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+#include "utils.h"
+
+namespace {
+
+    int io_uring_setup(unsigned entries, io_uring_params *p)
+    {
+        return syscall(__NR_io_uring_setup, entries, p);
+    }
+
+    int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+    {
+        return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+    }
+
+    uint64_t const PROVIDE_DATA = UINT64_MAX - UINT16_MAX; // plus id of the first buffer provided
+
+    template<class T>
+    T *at(void *base, uint32_t offset)
+    {
+        return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+    }
+
+    void *map(size_t size, int fd, off_t offset)
+    {
+        void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        return ptr == MAP_FAILED? nullptr : ptr;
+    }
+}
+
+URing::URing(unsigned entries)
+        : fd{-1}, sq_ring{nullptr}, cq_ring{nullptr}, sq_ring_size{0}, cq_ring_size{0}, sqes{nullptr},
+          sqe_tail{0}, buf_size{0}, buf_group{0}
+{
+    io_uring_params params = {};
+    if ((fd = io_uring_setup(entries, &params)) < 0) {
+        fd = -1;
+        throw UtilsError("Could not set up io_uring");
+    }
+    sq_entries = params.sq_entries;
+    cq_entries = params.cq_entries;
+    sq_ring_size = params.sq_off.array + sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + cq_entries * sizeof(io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+        sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+    }
+    sq_ring = map(sq_ring_size, fd, IORING_OFF_SQ_RING);
+    cq_ring = single? sq_ring : map(cq_ring_size, fd, IORING_OFF_CQ_RING);
+    void *sqes_ptr = map(sq_entries * sizeof(io_uring_sqe), fd, IORING_OFF_SQES);
+    sqes = static_cast<io_uring_sqe *>(sqes_ptr);
+    if (!sq_ring || !cq_ring || !sqes) {
+        release();
+        throw UtilsError("Could not map io_uring rings");
+    }
+    sq_head = at<unsigned>(sq_ring, params.sq_off.head);
+    sq_tail = at<unsigned>(sq_ring, params.sq_off.tail);
+    sq_mask = at<unsigned>(sq_ring, params.sq_off.ring_mask);
+    sq_array = at<unsigned>(sq_ring, params.sq_off.array);
+    cq_head = at<unsigned>(cq_ring, params.cq_off.head);
+    cq_tail = at<unsigned>(cq_ring, params.cq_off.tail);
+    cq_mask = at<unsigned>(cq_ring, params.cq_off.ring_mask);
+    cqes = at<io_uring_cqe>(cq_ring, params.cq_off.cqes);
+    sqe_tail = *sq_tail;
+}
+
+URing::~URing()
+{
+    release();
+}
+
+void URing::release()
+{
+    if (sqes) {
+        munmap(sqes, sq_entries * sizeof(io_uring_sqe));
+        sqes = nullptr;
+    }
+    if (cq_ring && cq_ring != sq_ring) {
+        munmap(cq_ring, cq_ring_size);
+    }
+    if (sq_ring) {
+        munmap(sq_ring, sq_ring_size);
+    }
+    sq_ring = cq_ring = nullptr;
+    if (fd != -1) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+io_uring_sqe *URing::get_sqe()
+{
+    if (sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+        submit_and_wait(0);
+        if (sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+            return nullptr;
+        }
+    }
+    unsigned idx = sqe_tail++ & *sq_mask;
+    io_uring_sqe *sqe = &sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array[idx] = idx;
+    return sqe;
+}
+
+int URing::submit_and_wait(unsigned wait_nr)
+{
+    // buffers that failed to be given back go again while there is room for them
+    while (!unprovided.empty() && sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) < sq_entries) {
+        provide(unprovided.back(), 1);
+        unprovided.pop_back();
+    }
+    // entries become visible to the kernel only after the tail update,
+    // the ones it did not consume on error go with the next call
+    __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    unsigned flags = wait_nr > 0? IORING_ENTER_GETEVENTS : 0;
+    int ret = io_uring_enter(fd, to_submit, wait_nr, flags);
+    return ret < 0? -errno : ret;
+}
+
+io_uring_cqe *URing::peek_cqe()
+{
+    unsigned head;
+    while ((head = *cq_head) != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+        io_uring_cqe *cqe = &cqes[head & *cq_mask];
+        if (cqe->user_data < PROVIDE_DATA) {
+            return cqe;
+        }
+        if (cqe->res < 0) {
+            unprovided.push_back(cqe->user_data - PROVIDE_DATA);
+        }
+        cqe_seen();
+    }
+    return nullptr;
+}
+
+void URing::cqe_seen()
+{
+    __atomic_store_n(cq_head, *cq_head + 1, __ATOMIC_RELEASE);
+}
+
+io_uring_sqe *URing::provide(unsigned first_id, unsigned count)
+{
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe) {
+        return nullptr;
+    }
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = count;
+    sqe->addr = reinterpret_cast<uint64_t>(buffer(first_id));
+    sqe->len = buf_size;
+    sqe->off = first_id;
+    sqe->buf_group = buf_group;
+    // only failures are reported, peek_cqe takes them
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = PROVIDE_DATA + first_id;
+    return sqe;
+}
+
+void URing::register_buffers(uint16_t group, unsigned count, unsigned size)
+{
+    buffers.assign(static_cast<size_t>(count) * size, '\0');
+    buf_group = group;
+    buf_size = size;
+    // initial provision is waited for so that failure is known up front
+    io_uring_sqe *sqe = provide(0, count);
+    if (!sqe) {
+        throw UtilsError("Could not provide io_uring buffers");
+    }
+    sqe->flags = 0;
+    sqe->user_data = 0;
+    io_uring_cqe *cqe = nullptr;
+    bool ok = submit_and_wait(1) >= 0 && (cqe = peek_cqe()) != nullptr && cqe->res >= 0;
+    if (cqe) {
+        cqe_seen();
+    }
+    if (!ok) {
+        throw UtilsError("Could not provide io_uring buffers");
+    }
+}
+
+char *URing::buffer(unsigned id)
+{
+    return &buffers[static_cast<size_t>(id) * buf_size];
+}
+
+unsigned URing::buffer_size()
+{
+    return buf_size;
+}
+
+void URing::recycle_buffer(unsigned id)
+{
+    if (!provide(id, 1)) {
+        unprovided.push_back(id);
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef II_URING_H
+#define II_URING_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <linux/io_uring.h>
+
+/* Minimal io_uring wrapper over raw system calls */
+class URing {
+    int fd;
+    unsigned sq_entries, cq_entries;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size;
+    io_uring_sqe *sqes;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    io_uring_cqe *cqes;
+    unsigned sqe_tail; // prepared entries not yet published to the kernel end here
+
+    /* Provided buffers, given back to the kernel with the next submission */
+    std::vector<char> buffers;
+    unsigned buf_size;
+    uint16_t buf_group;
+    std::vector<unsigned> unprovided; // ids kernel didn't take back, provided again on submission
+
+    io_uring_sqe *provide(unsigned first_id, unsigned count);
+
+    void release();
+
+public:
+    URing(unsigned entries);
+    ~URing();
+    URing(URing const &) = delete;
+    URing &operator=(URing const &) = delete;
+
+    // zeroed submission entry, nullptr when submission queue is full even after submitting
+    io_uring_sqe *get_sqe();
+    // submits prepared entries and waits for at least wait_nr completions, -errno on error
+    int submit_and_wait(unsigned wait_nr);
+
+    // next completion or nullptr, has to be followed by cqe_seen,
+    // completions of entries queued by URing itself are handled and skipped
+    io_uring_cqe *peek_cqe();
+    void cqe_seen();
+
+    /* Buffers kernel picks from for IOSQE_BUFFER_SELECT receives */
+    void register_buffers(uint16_t group, unsigned count, unsigned size);
+    char *buffer(unsigned id);
+    unsigned buffer_size();
+    void recycle_buffer(unsigned id);
+};
+
+#endif //II_URING_H
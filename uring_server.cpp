@@ -0,0 +1,248 @@
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <sys/socket.h>
+#include "uring.h"
+#include "uring_server.h"
+#include "trace.h"
+
+namespace {
+
+    unsigned const RING_ENTRIES = 256;
+    unsigned const RECV_BUFFERS = 256; // power of two
+    uint16_t const RECV_GROUP = 0;
+    size_t const SEND_SLOTS = 64;
+
+    uint64_t const RECV_TAG = 0, TIMEOUT_TAG = 1, NOP_TAG = 2, SEND_TAG = 3; // send slot i has tag SEND_TAG + i
+
+    /* Datagram owned by the kernel until its send completes */
+    struct SendSlot {
+        std::string buffer;
+        sockaddr_storage addr;
+        iovec iov;
+        msghdr msg;
+    };
+
+    class Loop {
+        URing ring;
+        int sock;
+        GameState &gs;
+        uint64_t tick;
+
+        msghdr recv_msg;
+        bool recv_armed;
+
+        __kernel_timespec deadline;
+        bool timer_active;
+
+        std::vector<SendSlot> slots;
+        std::vector<size_t> free_slots;
+        std::vector<size_t> blocked_slots; // sent again once the socket takes more
+
+        static uint64_t now()
+        {
+            timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return static_cast<uint64_t>(ts.tv_sec) * NANOSPERS + ts.tv_nsec;
+        }
+
+        void arm_recv()
+        {
+            io_uring_sqe *sqe = ring.get_sqe();
+            if (!sqe) {
+                return;
+            }
+            sqe->opcode = IORING_OP_RECVMSG;
+            sqe->fd = sock;
+            sqe->addr = reinterpret_cast<uint64_t>(&recv_msg);
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = RECV_GROUP;
+            sqe->user_data = RECV_TAG;
+            recv_armed = true;
+        }
+
+        void arm_timeout(uint64_t at)
+        {
+            io_uring_sqe *sqe = ring.get_sqe();
+            if (!sqe) {
+                return;
+            }
+            deadline.tv_sec = at / NANOSPERS;
+            deadline.tv_nsec = at % NANOSPERS;
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->fd = -1;
+            sqe->addr = reinterpret_cast<uint64_t>(&deadline);
+            sqe->len = 1;
+            sqe->timeout_flags = IORING_TIMEOUT_ABS;
+            sqe->user_data = TIMEOUT_TAG;
+            timer_active = true;
+        }
+
+        uint64_t deadline_nanos()
+        {
+            return static_cast<uint64_t>(deadline.tv_sec) * NANOSPERS + deadline.tv_nsec;
+        }
+
+        void got_datagram(io_uring_cqe *cqe)
+        {
+            if (!(cqe->flags & IORING_CQE_F_BUFFER)) {
+                return;
+            }
+            unsigned id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            char *buf = ring.buffer(id);
+            auto out = reinterpret_cast<io_uring_recvmsg_out *>(buf);
+            char *payload = buf + sizeof(*out) + recv_msg.msg_namelen + recv_msg.msg_controllen;
+            // simply ignore incorrect messages
+            if (cqe->res > 0 && !(out->flags & MSG_TRUNC) && out->payloadlen > 0
+                && out->payloadlen <= MAX_FROM_CLIENT_DATAGRAM_SIZE) {
+                sockaddr_storage client_addr = {};
+                memcpy(&client_addr, buf + sizeof(*out), std::min<size_t>(out->namelen, sizeof(client_addr)));
+                std::string buffer(payload, out->payloadlen);
+                gs.got_message(buffer, client_addr, milliseconds_since_epoch());
+            }
+            ring.recycle_buffer(id);
+        }
+
+        void prepare_send(io_uring_sqe *sqe, size_t i)
+        {
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = sock;
+            sqe->addr = reinterpret_cast<uint64_t>(&slots[i].msg);
+            sqe->user_data = SEND_TAG + i;
+        }
+
+        void queue_sends()
+        {
+            // datagrams already counted as sent go first, kernel waits until they fit
+            while (!blocked_slots.empty()) {
+                io_uring_sqe *sqe = ring.get_sqe();
+                if (!sqe) {
+                    return;
+                }
+                prepare_send(sqe, blocked_slots.back());
+                sqe->ioprio = IORING_RECVSEND_POLL_FIRST;
+                blocked_slots.pop_back();
+            }
+            while (gs.want_to_write() && !free_slots.empty()) {
+                io_uring_sqe *sqe = ring.get_sqe();
+                if (!sqe) {
+                    return;
+                }
+                size_t i = free_slots.back();
+                SendSlot &slot = slots[i];
+                if (!gs.next_datagram(slot.buffer, slot.addr)) {
+                    // nothing to send to this player, entry goes out as a no-op
+                    sqe->opcode = IORING_OP_NOP;
+                    sqe->user_data = NOP_TAG;
+                    continue;
+                }
+                free_slots.pop_back();
+                slot.iov.iov_base = &slot.buffer[0];
+                slot.iov.iov_len = slot.buffer.size();
+                slot.msg = {};
+                slot.msg.msg_name = &slot.addr;
+                slot.msg.msg_namelen = sizeof(slot.addr);
+                slot.msg.msg_iov = &slot.iov;
+                slot.msg.msg_iovlen = 1;
+                prepare_send(sqe, i);
+                // sending queue moves on right away, so a send that would block isn't dropped
+                // but queued again by its completion, as the poll loop tries it again
+                gs.mark_sent();
+            }
+        }
+
+    public:
+        Loop(int sock, GameState &gs, uint64_t tick)
+                : ring(RING_ENTRIES), sock{sock}, gs(gs), tick{tick}, recv_msg{}, recv_armed{false},
+                  deadline{}, timer_active{false}, slots(SEND_SLOTS)
+        {
+            size_t header = sizeof(io_uring_recvmsg_out) + sizeof(sockaddr_storage);
+            ring.register_buffers(RECV_GROUP, RECV_BUFFERS, header + MAX_FROM_CLIENT_DATAGRAM_SIZE);
+            recv_msg.msg_namelen = sizeof(sockaddr_storage);
+            for (size_t i = SEND_SLOTS; i > 0; --i) {
+                free_slots.push_back(i - 1);
+            }
+        }
+
+        // false if receiving on sock isn't supported, nothing else is served then
+        bool run(bool const &finish)
+        {
+            arm_recv();
+            while (!finish) {
+                queue_sends();
+                int ret = ring.submit_and_wait(1);
+                if (ret < 0 && ret != -EINTR && ret != -EBUSY && ret != -EAGAIN) {
+                    std::cerr << "io_uring_enter: " << strerror(-ret) << std::endl;
+                    return true;
+                }
+                while (io_uring_cqe *cqe = ring.peek_cqe()) {
+                    uint64_t tag = cqe->user_data;
+                    if (tag == RECV_TAG) {
+                        // receive is armed again only after an error it can recover from
+                        if (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -EINTR &&
+                                cqe->res != -EAGAIN && cqe->res != -ENOMEM) {
+                            std::cerr << "io_uring recvmsg: " << strerror(-cqe->res) << std::endl;
+                            ring.cqe_seen();
+                            return false;
+                        }
+                        got_datagram(cqe);
+                        recv_armed = cqe->flags & IORING_CQE_F_MORE;
+                    }
+                    else if (tag == TIMEOUT_TAG) {
+                        timer_active = false;
+                        if (std::get<1>(gs.has_active_round())) {
+                            gs.cycle();
+                            // if round has not finished within last cycle, skip ticks missed meanwhile
+                            if (std::get<1>(gs.has_active_round())) {
+                                uint64_t next = deadline_nanos() + tick, current = now();
+                                if (next <= current) {
+                                    next += (current - next) / tick * tick + tick;
+                                }
+                                arm_timeout(next);
+                            }
+                        }
+                    }
+                    else if (tag >= SEND_TAG && tag < SEND_TAG + SEND_SLOTS) {
+                        if (cqe->res == -EAGAIN || cqe->res == -ENOBUFS) {
+                            Trace::record(Trace::WOULD_BLOCK, slots[tag - SEND_TAG].buffer.size(), 1);
+                            blocked_slots.push_back(tag - SEND_TAG);
+                        }
+                        else {
+                            if (cqe->res >= 0) {
+                                Trace::record(Trace::SENT, cqe->res, 1);
+                            }
+                            free_slots.push_back(tag - SEND_TAG);
+                        }
+                    }
+                    ring.cqe_seen();
+                }
+                if (!recv_armed) {
+                    arm_recv();
+                }
+                // if new round started as a consequence of player's move
+                if (std::get<1>(gs.has_active_round()) && !timer_active) {
+                    arm_timeout(now() + tick);
+                }
+            }
+            return true;
+        }
+    };
+}
+
+bool run_uring_loop(int sock, GameState &gs, uint64_t tick_nanos, bool const &finish)
+{
+    std::unique_ptr<Loop> loop;
+    try {
+        loop.reset(new Loop(sock, gs, tick_nanos));
+    }
+    catch (UtilsError const &e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+    return loop->run(finish);
+}
@@ -0,0 +1,13 @@
+#ifndef II_URING_SERVER_H
+#define II_URING_SERVER_H
+
+#include <cstdint>
+#include "game_state.h"
+
+// Serves the game over sock until finish is set using io_uring: multishot receives into
+// provided buffers, sends batched as submission entries and the tick as an absolute timeout.
+// Returns false if io_uring is not available or can't receive on sock, the game is left as it
+// was served so far.
+bool run_uring_loop(int sock, GameState &gs, uint64_t tick_nanos, bool const &finish);
+
+#endif //II_URING_SERVER_H
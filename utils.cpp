@@ -39,6 +39,19 @@ uint32_t str2uint32_t(std::string str)
     return parsed;
 }
 
+char *format_uint32(char *out, uint32_t n)
+{
+    char digits[10];
+    char *p = digits + sizeof(digits);
+    do {
+        *--p = static_cast<char>('0' + n % 10);
+        n /= 10;
+    } while (n);
+    size_t len = digits + sizeof(digits) - p;
+    memcpy(out, p, len);
+    return out + len;
+}
+
 bool is_valid_port(uint32_t port_number)
 {
     return port_number <= 65535;
@@ -53,6 +66,11 @@ std::string last_err(std::string pref="")
 
 Socket::Socket() : fd{-1} {}
 
+Socket::Socket(Socket &&socket) : fd{socket.fd}
+{
+    socket.fd = -1;
+}
+
 Socket& Socket::operator=(Socket &&socket)
 {
     fd = socket.fd;
@@ -104,15 +122,20 @@ void create_timer(timer_t &timer, uint64_t nanosecs, void (*handler)(int, siginf
     }
 
     /* Start the timer */
+    if (!set_timer(timer, nanosecs)) {
+        throw UtilsError("Could not start the timer");
+    }
+}
+
+// (re)starts periodic timer, first expiration is one full period from now
+bool set_timer(timer_t timer, uint64_t nanosecs)
+{
     itimerspec its;
     its.it_value.tv_sec = nanosecs / NANOSPERS;
     its.it_value.tv_nsec = nanosecs % NANOSPERS;
     its.it_interval.tv_sec = its.it_value.tv_sec;
     its.it_interval.tv_nsec = its.it_value.tv_nsec;
-
-    if (timer_settime(timer, 0, &its, NULL) == -1) {
-        throw UtilsError("Could not start the timer");
-    }
+    return timer_settime(timer, 0, &its, NULL) != -1;
 }
 
 bool disarm_timer(timer_t timer, itimerspec &old)
@@ -146,4 +169,9 @@ uint64_t milliseconds_since_epoch()
     return UINT64_C(1000) * tv.tv_sec + tv.tv_usec / UINT64_C(1000);
 }
 
-
+uint64_t monotonic_microseconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return UINT64_C(1000000) * ts.tv_sec + ts.tv_nsec / UINT64_C(1000);
+}
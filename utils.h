@@ -20,8 +20,11 @@
 
 uint32_t const NANOSPERS = 1000000000;
 size_t const MAX_FROM_SERVER_DATAGRAM_SIZE = 512;
-size_t const MAX_FROM_CLIENT_DATAGRAM_SIZE = 77;
+size_t const MAX_PLAYER_NAME_LENGTH = 64;
+// 77 bytes in legacy format, the rest is taken by negotiated protocol extensions
+size_t const MAX_FROM_CLIENT_DATAGRAM_SIZE = 112;
 uint32_t const REQUIRED_PLAYERS = 2;
+uint64_t const INACTIVITY_TOLERANCE = 2000; // ms of silence after which server drops a client
 
 bool operator==(sockaddr_storage const &a1, sockaddr_storage const &a2);
 
@@ -46,6 +49,9 @@ constexpr T bswap (T value, char* ptr=0)
 
 uint32_t str2uint32_t(std::string);
 
+// writes decimal representation of n at out (up to 10 chars), returns end of written text
+char *format_uint32(char *out, uint32_t n);
+
 std::string last_err(std::string);
 
 bool is_valid_port(uint32_t port_number);
@@ -68,9 +74,12 @@ struct Socket {
 };
 
 void create_timer(timer_t &timer, uint64_t nanosecs, void (*handler)(int, siginfo_t *, void *));
+bool set_timer(timer_t timer, uint64_t nanosecs);
 bool disarm_timer(timer_t timer, itimerspec &old);
 bool resume_timer(timer_t timer, itimerspec &resume);
 
 uint64_t milliseconds_since_epoch();
+// for measuring intervals only
+uint64_t monotonic_microseconds();
 
 #endif //II_UTILS_H